@@ -5,28 +5,311 @@
  * bounded buffer problem using mutex locks
  * and counting semaphores. The consumption
  * order is "first in, first out". The production
- * order is "circular".
+ * order is "circular". The lock-free rings trade the
+ * mutex and semaphores for atomic indices.
  **/
 
+#define _GNU_SOURCE
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include "buffer.h"
-#define MAX_THREADS 93
+#define THREADS_PER_CPU 32
+#define USAGE "Usage: buffer [-m mutex|spsc|mpmc|sharded [-f home|rr|longest]|pipe] [-S <name>] [-w block|spin|yield|park [-s <spins>]] [-a none|siblings|socket|spread|<cpu list>] [-c <capacity>] [-B <batch>] [-p <bytes>[-<bytes>] [-x]] [-b [-n <items>]] [-i <seconds>] [-q] [-P <delay>] [-C <delay>] [-r <seed>] [-l <lanes>[:strict|:<weights>]] [-F block|fail|drop|timeout:<us>] [-e] <sleep time> <# of producer threads> <# of consumer threads>\n"
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB)
+#define DEFAULT_SPINS 1000
+#define LINE_LENGTH 256
+#define OCCUPANCY_BUCKETS 17
+#define OCCUPANCY_PERIOD 64
+#define WAIT_SAMPLE 16
+#define LOG_RING_SIZE 1024
+#define LOG_OUTPUT_SIZE 65536
+#define MAX_LANES 8
 
-buffer_item buffer[BUFFER_SIZE];
-pthread_mutex_t mutex;
-static int p_buf_index;
-static int c_buf_index;
-sem_t empty;
-sem_t full;
+static bounded_buffer *buffer;
+static buffer_mode mode = MODE_MUTEX;
 
-void insert_item(buffer_item item, void *param);
-void remove_item(buffer_item item, void *param);
+//Sharded mode gives producer k the SPSC ring shards[k], consumers
+//park on shard_event while every shard is empty
+static bounded_buffer **shards;
+static int shard_count;
+static int consumer_count;
+static fairness_policy fairness = FAIR_HOME;
+static _Alignas(CACHE_LINE_SIZE) wait_event shard_event;
+
+//Priority lanes are rings of their own in the spsc and mpmc modes,
+//lanes[0] being the buffer and the most urgent. Consumers park on
+//lane_event while every lane is empty.
+static bounded_buffer **lanes;
+static int lane_count = 1;
+static lane_order order = LANES_STRICT;
+static int lane_weights[MAX_LANES];
+static _Alignas(CACHE_LINE_SIZE) wait_event lane_event;
+
+//What producers do on a full ring, and the items they dropped
+static full_policy policy = FULL_BLOCK;
+static uint64_t full_timeout_us;
+static atomic_long dropped_items;
+
+//With -e consumers of the rings wait in epoll on ready_fd, which a
+//producer writes when it finds the signal disarmed: a consumer
+//disarms it before sleeping, so a burst after the ring went empty
+//costs one write. stop_fd is written once at the end and never read.
+static int ready_fd = -1;
+static int stop_fd = -1;
+static _Alignas(CACHE_LINE_SIZE) atomic_int ready_signaled;
+static atomic_uint_least64_t ready_signal_ns;
+
+//Shared mode maps the buffer from the POSIX shared memory object
+//shared_name, and the futexes lose their process-private flag
+static const char *shared_name;
+static int futex_private = FUTEX_PRIVATE_FLAG;
+
+//Pipe mode writes items to pipe_fds[1] and reads them from pipe_fds[0]
+static int pipe_fds[2];
+static wait_strategy strategy = WAIT_BLOCK;
+
+//Tries made before a yield or park
+static int spin_limit = DEFAULT_SPINS;
+
+//A CPU's place in the topology read from /sys. rank numbers the
+//hardware threads of a core and slot the CPU within its package.
+typedef struct {
+	int cpu;
+	int package;
+	int core;
+	int node;
+	int rank;
+	int slot;
+} cpu_info;
+
+//A distribution of delays. UNIFORM draws from low to high, CONSTANT
+//and EXPONENTIAL take low as the delay or its mean, and BURSTY makes
+//run gaps with a mean of low before an off period with a mean of high.
+typedef struct {
+	distribution_kind kind;
+	uint64_t low;
+	uint64_t high;
+	long run;
+} distribution;
+
+//Producers wait arrival between bursts and consumers service
+//between removals, 1 to 10 s by default. Threads draw from their
+//own generator, seeded from seed and their index.
+static distribution arrival = { DIST_UNIFORM, 1000000, 10000000, 0 };
+static distribution service = { DIST_UNIFORM, 1000000, 10000000, 0 };
+static uint64_t seed;
+
+//State of a xoshiro256** generator
+typedef struct {
+	uint64_t s[4];
+} rng_state;
+
+static placement place = PLACE_NONE;
+static cpu_info *cpus;
+static int cpu_count;
+static int *cpu_order;
+static int cpu_order_length;
+
+//Benchmark mode runs without sleeps or per-item output until
+//stop is set or every producer made items_per_producer items
+static int benchmark;
+static long items_per_producer;
+
+//Most items a thread moves per insert_items()/remove_items() call
+static int batch = 1;
+
+//Payload sizes drawn per item, none when payload_max is 0. The copy
+//baseline copies every payload in and out of the slab block.
+static uint32_t payload_min;
+static uint32_t payload_max;
+static int payload_copy;
+static slab_class slab[SLAB_CLASSES];
+static atomic_int stop;
+static atomic_int producers_done;
+
+//Threads nap between items on nap_cond so a stop wakes them at once,
+//and count their items for the report at the stop and after draining
+static pthread_mutex_t nap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nap_cond;
+static atomic_long produced_items;
+static atomic_long consumed_items;
+
+//Contention is reported to stderr every report_interval seconds
+//while running when it is positive, and once at exit when it is
+//0. No report is made when it is -1.
+static int report_interval = -1;
+static int report_done;
+
+//Outside benchmark mode every item is logged to a ring of the
+//thread's own, unless quiet. The writer thread formats the lines
+//and writes them out, and serves a flush request once it finds
+//every ring empty after the request.
+static int logging;
+static int quiet;
+static atomic_int log_done;
+static atomic_uint log_requested;
+static atomic_uint log_served;
+
+/**
+ * An item a producer made or a consumer took, as a line to write
+ **/
+
+typedef struct {
+	int id;
+	int value;
+	int consumed;
+} log_record;
+
+/**
+ * Single-producer single-consumer ring of a thread's log records,
+ * the indices a cache line apart
+ **/
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	log_record records[LOG_RING_SIZE];
+} log_ring;
+
+/**
+ * Contention counters of one thread. Only the owning thread writes
+ * them, with a relaxed load and store rather than a locked add, so
+ * the reporter may read them while it runs. Waits on a full buffer
+ * are the producers', waits on an empty buffer the consumers'. The
+ * occupancy histogram samples the fill of the buffer every
+ * OCCUPANCY_PERIOD calls, in 16ths of its capacity.
+ **/
+
+typedef struct {
+	atomic_long locks;
+	atomic_long contended;
+	atomic_long lock_wait_ns;
+	atomic_long full_waits;
+	atomic_long full_wait_ns;
+	atomic_long empty_waits;
+	atomic_long empty_wait_ns;
+	atomic_long occupancy[OCCUPANCY_BUCKETS];
+	unsigned int calls;
+} contention_stats;
+
+/**
+ * A thread's counts for one priority lane: the items it inserted,
+ * rejected on a full ring, dropped as the oldest to make room and
+ * removed, and for benchmark consumers their latency histogram
+ **/
+
+typedef struct {
+	long inserted;
+	long rejected;
+	long dropped;
+	long removed;
+	long *latency;
+	uint64_t max_latency;
+} lane_stats;
+
+/**
+ * Per-thread benchmark results, a cache line apart so threads never
+ * write to each other's lines. Consumers also keep a log-linear
+ * histogram of enqueue-to-dequeue latencies, 16 buckets per power of two.
+ **/
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) int id;
+	long ops;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t max_latency;
+	long *latency;
+	long parks;
+	long wakeups;
+	long steals;
+	long bytes;
+	int cpu;
+	contention_stats contention;
+	log_ring *log;
+	rng_state rng;
+	long burst;
+	lane_stats *per_lane;
+	int epoll_fd;
+	long wakes;
+	long *wake_latency;
+	uint64_t max_wake_latency;
+} thread_stats;
+
+//Statistics of the calling thread, for the waits deep in insert/remove
+static _Thread_local thread_stats *current;
+
+//Threads the reporter sums up and the log writer drains
+typedef struct {
+	thread_stats *threads;
+	int producers;
+	int consumers;
+	uint64_t start_ns;
+} report_args;
+
+bounded_buffer *buffer_create(size_t capacity);
+bounded_buffer *buffer_attach(const char *name, size_t capacity);
+void buffer_detach(bounded_buffer *b, const char *name);
+int insert_items(buffer_item items[], int n, void *param);
+int remove_items(buffer_item items[], int n, void *param);
+int insert_item(buffer_item item, void *param);
+int remove_item(buffer_item *item, void *param);
 void *consumer(void *param);
 void *producer(void *param);
+void print_benchmark(thread_stats *threads, int producers, int consumers, uint64_t elapsed_ns);
+void print_contention(thread_stats *threads, int producers, int consumers, uint64_t elapsed_ns, int per_thread);
+static uint64_t now_ns(void);
+static int latency_bucket(uint64_t value);
+static uint64_t bucket_value(int bucket);
+static void wake_waiters(wait_event *event, int n);
+static int take_permits(batch_semaphore *sem, int n, int full, uint64_t *since);
+static void give_permits(batch_semaphore *sem, int n);
+static inline void tally(atomic_long *counter, long n);
+static int parse_cpu_list(const char *list, int *out, int max);
+static void load_topology(void);
+static int cpu_node(int cpu);
+static void build_cpu_order(void);
+static int pin_attr(pthread_attr_t *attr, int slot);
+static void *create_buffer(void *param);
+static int address_node(void *address);
+static void slab_init(uint32_t min, uint32_t max, uint32_t blocks);
+static void *slab_alloc(uint32_t length);
+static void slab_free(void *data, uint32_t length);
+static int thread_limit(void);
+static void request_stop(void);
+static void *reporter(void *param);
+static void *log_writer(void *param);
+static void log_flush(void);
+static int parse_distribution(const char *spec, distribution *d);
+static void rng_seed(rng_state *r, uint64_t seed);
+static inline uint64_t rng_next(rng_state *r);
+static uint64_t draw_delay(const distribution *d, thread_stats *self);
+static int lanes_reported(void);
+static void print_progress(const char *when);
+void print_lanes(thread_stats *threads, int producers, int consumers);
 
 int main(int argc, char *argv[]) {
 	
@@ -35,10 +318,184 @@ int main(int argc, char *argv[]) {
 	int sleep_time = 0;
 	int p_index;
 	int c_index;
+	int opt;
+	long capacity = DEFAULT_BUFFER_SIZE;
+	uint64_t start_ns;
+	const char *cpu_list = NULL;
+	
+	//Command Line Options
+	while ((opt = getopt(argc, argv, "a:bB:c:C:ef:F:i:l:m:n:p:P:qr:s:S:w:x")) != -1) {
+		switch (opt) {
+		case 'a':
+			if (strcmp(optarg, "none") == 0) {
+				place = PLACE_NONE;
+			} else if (strcmp(optarg, "siblings") == 0) {
+				place = PLACE_SIBLINGS;
+			} else if (strcmp(optarg, "socket") == 0) {
+				place = PLACE_SOCKET;
+			} else if (strcmp(optarg, "spread") == 0) {
+				place = PLACE_SPREAD;
+			} else if (isdigit(optarg[0])) {
+				place = PLACE_LIST;
+				cpu_list = optarg;
+			} else {
+				printf(USAGE);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			benchmark = 1;
+			break;
+		case 'e':
+			ready_fd = 0;
+			break;
+		case 'B':
+			batch = atoi(optarg);
+			if (batch <= 0) {
+				printf("The batch size must be positive.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			capacity = atol(optarg);
+			if (capacity <= 0 || (capacity & (capacity - 1)) != 0) {
+				printf("The buffer capacity must be a power of two.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			if (strcmp(optarg, "block") == 0) {
+				policy = FULL_BLOCK;
+			} else if (strcmp(optarg, "fail") == 0) {
+				policy = FULL_FAIL;
+			} else if (strcmp(optarg, "drop") == 0) {
+				policy = FULL_DROP_OLDEST;
+			} else if (strncmp(optarg, "timeout:", 8) == 0 && isdigit(optarg[8])) {
+				policy = FULL_TIMEOUT;
+				full_timeout_us = strtoull(optarg + 8, NULL, 10);
+			} else {
+				printf(USAGE);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l': {
+			char *end;
+			int i;
+			lane_count = strtol(optarg, &end, 10);
+			if (*end == ':' && strcmp(end, ":strict") != 0) {
+				order = LANES_WEIGHTED;
+				for (i = 0; i < lane_count && i < MAX_LANES; i++) {
+					lane_weights[i] = strtol(end + 1, &end, 10);
+					if (lane_weights[i] <= 0 || *end != (i < lane_count - 1 ? ',' : '\0'))
+						break;
+				}
+				if (i < lane_count)
+					lane_count = 0;
+			} else if (*end != '\0' && *end != ':') {
+				lane_count = 0;
+			}
+			if (lane_count < 1 || lane_count > MAX_LANES) {
+				printf("Lanes are 1 to %d, then :strict or a positive weight per lane as in 3:4,2,1.\n", MAX_LANES);
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		case 'i':
+			report_interval = atoi(optarg);
+			if (report_interval < 0) {
+				printf("The report interval cannot be negative.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			items_per_producer = atol(optarg);
+			break;
+		case 'p': {
+			char *end;
+			payload_min = strtoul(optarg, &end, 10);
+			payload_max = *end == '-' ? strtoul(end + 1, NULL, 10) : payload_min;
+			if (payload_min == 0 || payload_max < payload_min || payload_max > 1U << SLAB_MAX_SHIFT) {
+				printf("Payload sizes go from 1 to %u bytes.\n", 1U << SLAB_MAX_SHIFT);
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+		case 'q':
+			quiet = 1;
+			break;
+		case 'x':
+			payload_copy = 1;
+			break;
+		case 'C':
+		case 'P':
+			if (parse_distribution(optarg, opt == 'P' ? &arrival : &service) != 0) {
+				printf("Delays are const:<us>, uniform:<us>-<us>, exp:<us> or burst:<run>:<us>:<us>.\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			seed = strtoull(optarg, NULL, 10);
+			break;
+		case 'f':
+			if (strcmp(optarg, "home") == 0) {
+				fairness = FAIR_HOME;
+			} else if (strcmp(optarg, "rr") == 0) {
+				fairness = FAIR_ROUND_ROBIN;
+			} else if (strcmp(optarg, "longest") == 0) {
+				fairness = FAIR_LONGEST;
+			} else {
+				printf(USAGE);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			if (strcmp(optarg, "mutex") == 0) {
+				mode = MODE_MUTEX;
+			} else if (strcmp(optarg, "spsc") == 0) {
+				mode = MODE_SPSC;
+			} else if (strcmp(optarg, "mpmc") == 0) {
+				mode = MODE_MPMC;
+			} else if (strcmp(optarg, "sharded") == 0) {
+				mode = MODE_SHARDED;
+			} else if (strcmp(optarg, "pipe") == 0) {
+				mode = MODE_PIPE;
+			} else {
+				printf(USAGE);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			spin_limit = atoi(optarg);
+			break;
+		case 'S':
+			shared_name = optarg;
+			futex_private = 0;
+			break;
+		case 'w':
+			if (strcmp(optarg, "block") == 0) {
+				strategy = WAIT_BLOCK;
+			} else if (strcmp(optarg, "spin") == 0) {
+				strategy = WAIT_SPIN;
+			} else if (strcmp(optarg, "yield") == 0) {
+				strategy = WAIT_YIELD;
+			} else if (strcmp(optarg, "park") == 0) {
+				strategy = WAIT_PARK;
+			} else {
+				printf(USAGE);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			printf(USAGE);
+			return EXIT_FAILURE;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
 	
 	//Command Line Arguments
 	if (argc != 4) {
-		printf("Usage: buffer <sleep time> <# of producer threads> <# of consumer threads>\n");
+		printf(USAGE);
 		return EXIT_FAILURE;
 	} else {
 		int i;
@@ -49,7 +506,7 @@ int main(int argc, char *argv[]) {
 		//Check if sleep time argument is a number
 		for (i = 0; sleepArg[i] != '\0'; i++) {
 			if (!isdigit(sleepArg[i])) {
-				printf("Usage: buffer <sleep time> <# of producer threads> <# of consumer threads>\n");
+				printf(USAGE);
 				return EXIT_FAILURE;
 			}
 		}
@@ -57,7 +514,7 @@ int main(int argc, char *argv[]) {
 		//Check if amount of producer threads argument is a number
 		for (i = 0; prodArg[i] != '\0'; i++) {
 			if (!isdigit(prodArg[i])) {
-				printf("Usage: buffer <sleep time> <# of producer threads> <# of consumer threads>\n");
+				printf(USAGE);
 				return EXIT_FAILURE;
 			}
 		}
@@ -65,7 +522,7 @@ int main(int argc, char *argv[]) {
 		//Check if amount of consumer threads argument is a number
 		for (i = 0; consArg[i] != '\0'; i++) {
 			if (!isdigit(consArg[i])) {
-				printf("Usage: buffer <sleep time> <# of producer threads> <# of consumer threads>\n");
+				printf(USAGE);
 				return EXIT_FAILURE;
 			}
 		}
@@ -76,131 +533,2442 @@ int main(int argc, char *argv[]) {
 		consumers = atoi(argv[3]);
 		
 		//Check if the amount of threads being created exceed the max amount that can be allowed
-		if (producers + consumers > MAX_THREADS) {
-			printf("Exceeded max limit of threads (%d threads) for this linux machine.\n", MAX_THREADS);
+		if (producers + consumers > thread_limit()) {
+			printf("Exceeded max limit of threads (%d threads) for this linux machine.\n", thread_limit());
 			sleep(1);
 			printf("Use a smaller number of consumer and producer threads.\n");
 			sleep(1);
 			return EXIT_FAILURE;
 		}
+		
+		//The SPSC ring is only safe with a single thread on each side
+		if (mode == MODE_SPSC && (producers > 1 || consumers > 1)) {
+			printf("The spsc buffer takes at most 1 producer and 1 consumer thread.\n");
+			return EXIT_FAILURE;
+		}
+
+		//Without a consumer anywhere a blocking producer waits out a
+		//full buffer forever, and its burst never ends for the stop
+		if (producers > 0 && consumers == 0 && shared_name == NULL && policy == FULL_BLOCK) {
+			printf("A private buffer takes at least 1 consumer thread unless -F fail, drop or timeout is set.\n");
+			return EXIT_FAILURE;
+		}
+
+		//Only the single ring holds nothing but process-independent data
+		if (shared_name != NULL && (mode == MODE_SHARDED || mode == MODE_PIPE || payload_max > 0)) {
+			printf("A shared buffer takes the mutex, spsc or mpmc mode and no payloads.\n");
+			return EXIT_FAILURE;
+		}
+
+		//Lanes and policies need the try of a ring, and dropping the
+		//oldest item makes a producer a second consumer of its ring
+		if ((lane_count > 1 || policy != FULL_BLOCK) && mode != MODE_SPSC && mode != MODE_MPMC) {
+			printf("Lanes and full-buffer policies take the spsc or mpmc mode.\n");
+			return EXIT_FAILURE;
+		}
+		if ((policy == FULL_DROP_OLDEST && mode != MODE_MPMC) || (lane_count > 1 && shared_name != NULL)) {
+			printf("Dropping the oldest item takes the mpmc mode, and a shared buffer has one lane.\n");
+			return EXIT_FAILURE;
+		}
+
+		//An eventfd only reaches the threads of this process
+		if (ready_fd == 0 && ((mode != MODE_SPSC && mode != MODE_MPMC) || shared_name != NULL)) {
+			printf("Readiness events take the spsc or mpmc mode of a private buffer.\n");
+			return EXIT_FAILURE;
+		}
 	}
 		
 	
 	//Initialize values
-	srand(time(NULL));
-	pthread_mutex_init(&mutex, NULL);
-	sem_init(&empty, 0, BUFFER_SIZE);
-	sem_init(&full, 0, 0);
+	if (seed == 0)
+		seed = (uint64_t) time(NULL) << 20 ^ getpid();
+	pthread_condattr_t nap_attr;
+	pthread_condattr_init(&nap_attr);
+	pthread_condattr_setclock(&nap_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&nap_cond, &nap_attr);
+	shard_count = mode == MODE_SHARDED ? producers : 0;
+	consumer_count = consumers;
+	load_topology();
+	if (place == PLACE_LIST) {
+		cpu_order = calloc(cpu_count, sizeof(int));
+		cpu_order_length = parse_cpu_list(cpu_list, cpu_order, cpu_count);
+		if (cpu_order_length == 0) {
+			printf("The cpu list names no online cpu.\n");
+			return EXIT_FAILURE;
+		}
+	} else if (place != PLACE_NONE) {
+		build_cpu_order();
+	}
+
+	//Fill the buffer from the first consumer's cpu so first touch
+	//puts its pages on that consumer's node
+	if (payload_max > 0) {
+		//Every block is either in a slot or in a thread's batch
+		long rings = shard_count > 0 ? shard_count : lane_count;
+		slab_init(payload_min, payload_max, capacity * rings + (long) (producers + consumers) * batch);
+	}
+	if (mode == MODE_PIPE && pipe(pipe_fds) != 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	if (ready_fd == 0) {
+		ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (ready_fd < 0 || stop_fd < 0) {
+			perror("eventfd");
+			return EXIT_FAILURE;
+		}
+	}
+	if (shared_name != NULL) {
+		buffer = buffer_attach(shared_name, capacity);
+		lanes = &buffer;
+		atomic_fetch_add(&buffer->open_producers, producers);
+	} else if (place != PLACE_NONE) {
+		pthread_t setup;
+		pthread_attr_t s_attr;
+		pthread_attr_init(&s_attr);
+		pin_attr(&s_attr, 1);
+		pthread_create(&setup, &s_attr, create_buffer, &capacity);
+		pthread_join(setup, NULL);
+	} else {
+		create_buffer(&capacity);
+	}
 	int count = 0;
-	c_buf_index = 0;
-	p_buf_index = 0;
+	int i;
 	c_index = 0;
 	p_index = 0;
+	pthread_t *tids = calloc(producers + consumers, sizeof(pthread_t));
+	thread_stats *threads = aligned_alloc(CACHE_LINE_SIZE, (producers + consumers) * sizeof(thread_stats));
+	memset(threads, 0, (producers + consumers) * sizeof(thread_stats));
+	for (count = 0; count < producers + consumers; count++) {
+		rng_seed(&threads[count].rng, seed + count);
+		threads[count].per_lane = calloc(lane_count, sizeof(lane_stats));
+	}
+	start_ns = now_ns();
+
+	//Start the log writer on a ring per thread
+	pthread_t log_tid;
+	report_args log_args = { threads, producers, consumers, start_ns };
+	logging = !benchmark && !quiet;
+	if (logging) {
+		for (count = 0; count < producers + consumers; count++) {
+			threads[count].log = aligned_alloc(CACHE_LINE_SIZE, sizeof(log_ring));
+			memset(threads[count].log, 0, sizeof(log_ring));
+		}
+		pthread_create(&log_tid, NULL, log_writer, &log_args);
+	}
 	
 	//Create producer thread(s)
 	for (count = 0; count < producers; count++) {
 		p_index++;
-		pthread_t p_tid;
 		pthread_attr_t p_attr;
 		pthread_attr_init(&p_attr);
-		pthread_create(&p_tid, &p_attr, producer, (void*) p_index);
+		pin_attr(&p_attr, 2 * count);
+		threads[count].id = p_index;
+		if (pthread_create(&tids[count], &p_attr, producer, &threads[count]) != 0) {
+			printf("Cannot create producer %d, running with %d.\n", p_index, count);
+			producers = count;
+			break;
+		}
 	}
 	
 	//Create consumer thread(s)
-	for (count = 0; count < consumers; count++) {
+	for (count = producers; count < producers + consumers; count++) {
 		c_index++;
-		pthread_t c_tid;
 		pthread_attr_t c_attr;
 		pthread_attr_init(&c_attr);
-		pthread_create(&c_tid, &c_attr, consumer, (void*) c_index);
+		pin_attr(&c_attr, 2 * (count - producers) + 1);
+		threads[count].id = c_index;
+		threads[count].latency = calloc(LATENCY_BUCKETS, sizeof(long));
+		threads[count].wake_latency = calloc(LATENCY_BUCKETS, sizeof(long));
+		for (i = 0; i < lane_count && benchmark && lanes_reported(); i++)
+			threads[count].per_lane[i].latency = calloc(LATENCY_BUCKETS, sizeof(long));
+		if (pthread_create(&tids[count], &c_attr, consumer, &threads[count]) != 0) {
+			printf("Cannot create consumer %d, running with %d.\n", c_index, count - producers);
+			consumers = count - producers;
+			break;
+		}
 	}
 	
-	//Sleep
-	sleep(sleep_time);
-	
+	//Report the contention of all threads while they run
+	pthread_t report_tid;
+	report_args report = { threads, producers, consumers, start_ns };
+	if (report_interval > 0)
+		pthread_create(&report_tid, NULL, reporter, &report);
+
+	//Run, then stop the producers after their current items and let
+	//the consumers drain the buffer
+	if (!benchmark || items_per_producer == 0) {
+		sleep(sleep_time);
+		request_stop();
+		log_flush();
+		if (!benchmark)
+			print_progress("Stopping");
+		fflush(stdout);
+	}
+	for (count = 0; count < producers; count++)
+		pthread_join(tids[count], NULL);
+
+	//Shared consumers drain until the producers of every process are done
+	if (shared_name != NULL) {
+		if (producers > 0 && atomic_fetch_sub(&buffer->open_producers, producers) == producers)
+			atomic_store(&buffer->closed, 1);
+		while (!atomic_load(&buffer->closed))
+			usleep(1000);
+	}
+	atomic_store(&producers_done, 1);
+	if (mode == MODE_PIPE)
+		close(pipe_fds[1]);
+	if (mode == MODE_MUTEX && strategy == WAIT_BLOCK) {
+		give_permits(&buffer->full, consumers);
+	}
+	wake_waiters(mode == MODE_SHARDED ? &shard_event : lane_count > 1 ? &lane_event : &buffer->not_empty, INT_MAX);
+	if (stop_fd >= 0 && write(stop_fd, &(uint64_t) { 1 }, sizeof(uint64_t)) < 0)
+		perror("write");
+	for (count = producers; count < producers + consumers; count++)
+		pthread_join(tids[count], NULL);
+	if (report_interval > 0) {
+		pthread_mutex_lock(&nap_mutex);
+		report_done = 1;
+		pthread_cond_broadcast(&nap_cond);
+		pthread_mutex_unlock(&nap_mutex);
+		pthread_join(report_tid, NULL);
+	}
+	if (logging) {
+		atomic_store(&log_done, 1);
+		pthread_join(log_tid, NULL);
+	}
+
+	if (benchmark)
+		print_benchmark(threads, producers, consumers, now_ns() - start_ns);
+	else
+		print_progress("Drained");
+	if (lanes_reported())
+		print_lanes(threads, producers, consumers);
+	if (report_interval >= 0)
+		print_contention(threads, producers, consumers, now_ns() - start_ns, 1);
+	if (shared_name != NULL)
+		buffer_detach(buffer, shared_name);
+
 	//Exit
 	return EXIT_SUCCESS;
 }
 
 /**
- * Inserts an item into the buffer with the protection of 
- * semaphore and mutex
+ * Returns how many producer and consumer threads may run: a pool of
+ * THREADS_PER_CPU per online cpu, within what RLIMIT_NPROC leaves
+ * besides the main thread
+ */
+
+static int thread_limit(void) {
+	long cpus_online = sysconf(_SC_NPROCESSORS_ONLN);
+	long limit = (cpus_online > 0 ? cpus_online : 1) * THREADS_PER_CPU;
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NPROC, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+	    && (long) rl.rlim_cur - 1 < limit)
+		limit = (long) rl.rlim_cur - 1;
+	return limit > 0 ? (int) limit : 0;
+}
+
+/**
+ * Sets the stop flag and wakes every napping thread
+ */
+
+static void request_stop(void) {
+	pthread_mutex_lock(&nap_mutex);
+	atomic_store(&stop, 1);
+	pthread_cond_broadcast(&nap_cond);
+	pthread_mutex_unlock(&nap_mutex);
+}
+
+/**
+ * Returns whether the run has lanes or a full-buffer policy whose
+ * counts are worth reporting per lane
+ */
+
+static int lanes_reported(void) {
+	return lane_count > 1 || policy != FULL_BLOCK;
+}
+
+/**
+ * Prints the items produced, consumed, dropped and still in flight
  *
- * @param item 	Random number to be inserted into the buffer
- * @param param	Locally generated thread ID 
+ * @param when	What the counts are taken at
+ */
+
+static void print_progress(const char *when) {
+	long produced = atomic_load(&produced_items);
+	long consumed = atomic_load(&consumed_items);
+	long dropped = atomic_load(&dropped_items);
+	printf("%s with %ld produced, %ld consumed, ", when, produced, consumed);
+	if (policy == FULL_DROP_OLDEST)
+		printf("%ld dropped, ", dropped);
+	printf("%ld in flight\n", produced - consumed - dropped);
+}
+
+/**
+ * Sleeps for a number of microseconds, or until a stop is requested
+ *
+ * @param us	Time to sleep
  */
 
-void insert_item(buffer_item item, void *param) {
-   sem_wait(&empty);
-   pthread_mutex_lock(&mutex);
-	if (p_buf_index >= BUFFER_SIZE) {
-		p_buf_index %= BUFFER_SIZE;
+static void nap(uint64_t us) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += us / 1000000;
+	deadline.tv_nsec += us % 1000000 * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
 	}
-	if (p_buf_index >= BUFFER_SIZE) {
-		printf("error producing %d to buffer\n", item);
-	} else {
-		buffer[p_buf_index] = item;
-		p_buf_index++;
-		printf("producer %d produced %d to buffer\n", param, item);
-   }
-	pthread_mutex_unlock(&mutex);
-   sem_post(&full);
+	pthread_mutex_lock(&nap_mutex);
+	while (!atomic_load(&stop)
+	       && pthread_cond_timedwait(&nap_cond, &nap_mutex, &deadline) != ETIMEDOUT)
+		;
+	pthread_mutex_unlock(&nap_mutex);
 }
 
 /**
- * Removes an item from the buffer with the protection of 
- * semaphore and mutex
+ * Prints the summed contention of all threads every report_interval
+ * seconds until main sets report_done
  *
- * @param item 	Random number to be inserted into the buffer
- * @param param	Locally generated thread ID 
+ * @param param	Threads to sum up
  */
 
-void remove_item(buffer_item item, void *param) {
-   sem_wait(&full);
-   pthread_mutex_lock(&mutex);
-	if (c_buf_index >= BUFFER_SIZE) {
-		c_buf_index %= BUFFER_SIZE;
+static void *reporter(void *param) {
+	report_args *report = param;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	pthread_mutex_lock(&nap_mutex);
+	while (!report_done) {
+		deadline.tv_sec += report_interval;
+		while (!report_done && pthread_cond_timedwait(&nap_cond, &nap_mutex, &deadline) != ETIMEDOUT)
+			;
+		if (!report_done)
+			print_contention(report->threads, report->producers, report->consumers,
+			                 now_ns() - report->start_ns, 0);
 	}
-	if (c_buf_index < 0) {
-		printf("error consuming %d from buffer\n", item);
-	} else {
-		item = buffer[c_buf_index];
-		printf("consumer %d consumed %d from buffer\n", param, item);
+	pthread_mutex_unlock(&nap_mutex);
+	return NULL;
+}
+
+/**
+ * Writes all of a buffer to a file descriptor, going on after
+ * partial writes and interrupts
+ *
+ * @param fd	File descriptor to write to
+ * @param data	Bytes to write
+ * @param length	Number of bytes
+ */
+
+static void write_all(int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("write");
+			return;
+		}
+		data += written;
+		length -= written;
 	}
-	buffer[c_buf_index] = 0;
-	c_buf_index++;
-   pthread_mutex_unlock(&mutex);
-   sem_post(&empty);
 }
 
 /**
- * Creates a random number to insert into the buffer
+ * Formats the records of every thread's log ring and writes them
+ * out in as few write() calls as LOG_OUTPUT_SIZE allows, napping for
+ * a millisecond whenever the rings are empty, until main sets
+ * log_done and the rings are drained
  *
- * @param param	Locally generated thread ID 
+ * @param param	Threads whose rings to drain
  */
 
-void *producer(void *param) {
-	buffer_item item;
-	int seed = rand();
-	
+static void *log_writer(void *param) {
+	report_args *threads = param;
+	char *out = malloc(LOG_OUTPUT_SIZE);
+	struct timespec idle = { 0, 1000000 };
+	int i;
 	while (1) {
-		sleep(rand() % 10 + 1);
-		item = rand_r(&seed);
-		insert_item(item, param);
+		unsigned int request = atomic_load(&log_requested);
+		int done = atomic_load(&log_done);
+		size_t used = 0;
+		long drained = 0;
+		for (i = 0; i < threads->producers + threads->consumers; i++) {
+			log_ring *ring = threads->threads[i].log;
+			size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+			size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+			for (; head != tail; head++) {
+				log_record *r = &ring->records[head % LOG_RING_SIZE];
+				if (used > LOG_OUTPUT_SIZE - LINE_LENGTH) {
+					write_all(STDOUT_FILENO, out, used);
+					used = 0;
+				}
+				used += sprintf(out + used, r->consumed ? "consumer %d consumed %d from buffer\n"
+				                : "producer %d produced %d to buffer\n", r->id, r->value);
+				drained++;
+			}
+			atomic_store_explicit(&ring->head, head, memory_order_release);
+		}
+		write_all(STDOUT_FILENO, out, used);
+		if (drained == 0) {
+			atomic_store(&log_served, request);
+			if (done)
+				break;
+			nanosleep(&idle, NULL);
+		}
 	}
+	free(out);
+	return NULL;
+}
+
+/**
+ * Waits until the log writer wrote every line logged so far, so a
+ * line printed next comes after them
+ */
+
+static void log_flush(void) {
+	if (!logging)
+		return;
+	unsigned int request = atomic_fetch_add(&log_requested, 1) + 1;
+	while ((int) (atomic_load(&log_served) - request) < 0)
+		usleep(100);
 }
 
 /**
- * Removes a number from the buffer
+ * Logs an item to the calling thread's ring, yielding to the log
+ * writer while the ring is full
  *
- * @param param	Locally generated thread ID 
+ * @param id	Locally generated thread ID
+ * @param value	Item produced or consumed
+ * @param consumed	Whether a consumer took the item
  */
- 
-void *consumer(void *param) {
-	buffer_item item;
-	
-	while (1) {
-		sleep(rand() % 10 + 1);
-		remove_item(item, param);
+
+static void log_item(int id, int value, int consumed) {
+	log_ring *ring = current->log;
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= LOG_RING_SIZE)
+		sched_yield();
+	ring->records[tail % LOG_RING_SIZE] = (log_record) { id, value, consumed };
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * Parses a delay distribution: const:<us>, uniform:<us>-<us>,
+ * exp:<us> or burst:<run>:<us>:<us>
+ *
+ * @param spec	Distribution from the command line
+ * @param d	Filled with the distribution
+ * @return 	0 on success, -1 if the spec is malformed
+ */
+
+static int parse_distribution(const char *spec, distribution *d) {
+	unsigned long long low;
+	unsigned long long high;
+	long run;
+	int end = 0;
+	if (sscanf(spec, "const:%llu%n", &low, &end) == 1 && spec[end] == '\0') {
+		*d = (distribution) { DIST_CONSTANT, low, low, 0 };
+	} else if (sscanf(spec, "uniform:%llu-%llu%n", &low, &high, &end) == 2 && spec[end] == '\0' && low <= high) {
+		*d = (distribution) { DIST_UNIFORM, low, high, 0 };
+	} else if (sscanf(spec, "exp:%llu%n", &low, &end) == 1 && spec[end] == '\0') {
+		*d = (distribution) { DIST_EXPONENTIAL, low, low, 0 };
+	} else if (sscanf(spec, "burst:%ld:%llu:%llu%n", &run, &low, &high, &end) == 3 && spec[end] == '\0' && run > 0) {
+		*d = (distribution) { DIST_BURSTY, low, high, run };
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Seeds a generator from one 64-bit number through splitmix64, so
+ * close seeds still give unrelated streams
+ *
+ * @param r	Generator to seed
+ * @param seed	Any number
+ */
+
+static void rng_seed(rng_state *r, uint64_t seed) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		r->s[i] = z ^ (z >> 31);
+	}
+}
+
+/**
+ * Returns the next number of a xoshiro256** generator
+ *
+ * @param r	Generator of the calling thread
+ */
+
+static inline uint64_t rng_next(rng_state *r) {
+	uint64_t *s = r->s;
+	uint64_t result = ((s[1] * 5) << 7 | (s[1] * 5) >> 57) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = s[3] << 45 | s[3] >> 19;
+	return result;
+}
+
+/**
+ * Returns an exponential delay around a mean
+ *
+ * @param r	Generator of the calling thread
+ * @param mean	Mean delay in us
+ */
+
+static uint64_t draw_exponential(rng_state *r, uint64_t mean) {
+	double u = (rng_next(r) >> 11) * 0x1.0p-53;
+	return (uint64_t) (-log1p(-u) * mean);
+}
+
+/**
+ * Draws the next delay of a thread from a distribution
+ *
+ * @param d	Distribution to draw from
+ * @param self	Statistics of the calling thread, holding its generator
+ * 		and its place in a burst
+ * @return 	Delay in us
+ */
+
+static uint64_t draw_delay(const distribution *d, thread_stats *self) {
+	switch (d->kind) {
+	case DIST_CONSTANT:
+		return d->low;
+	case DIST_UNIFORM:
+		return d->low + rng_next(&self->rng) % (d->high - d->low + 1);
+	case DIST_EXPONENTIAL:
+		return draw_exponential(&self->rng, d->low);
+	default:
+		if (++self->burst < d->run)
+			return draw_exponential(&self->rng, d->low);
+		self->burst = 0;
+		return draw_exponential(&self->rng, d->high);
+	}
+}
+
+/**
+ * Returns the monotonic time in ns
+ */
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Returns the latency histogram bucket of a value in ns. Values
+ * below LATENCY_SUB get a bucket each, larger ones keep their top
+ * LATENCY_SUB_BITS bits below the leading one.
+ */
+
+static int latency_bucket(uint64_t value) {
+	if (value < LATENCY_SUB)
+		return (int) value;
+	int exponent = 63 - __builtin_clzll(value);
+	return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB
+	       + (int) ((value >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+/**
+ * Returns the smallest value in ns that falls into a latency bucket
+ */
+
+static uint64_t bucket_value(int bucket) {
+	if (bucket < LATENCY_SUB)
+		return bucket;
+	int exponent = bucket / LATENCY_SUB + LATENCY_SUB_BITS - 1;
+	return ((uint64_t) LATENCY_SUB | (bucket % LATENCY_SUB)) << (exponent - LATENCY_SUB_BITS);
+}
+
+/**
+ * Parses a cpu list such as "0-3,8,10-11" as found in /sys or
+ * given with -a. Once the topology is loaded only online cpus
+ * are kept.
+ *
+ * @param list	List to parse
+ * @param out	Filled with the cpu numbers
+ * @param max	Most cpus to keep
+ * @return 	Number of cpus kept
+ */
+
+static int parse_cpu_list(const char *list, int *out, int max) {
+	int count = 0;
+	while (*list != '\0' && count < max) {
+		char *end;
+		long first = strtol(list, &end, 10);
+		long last = first;
+		if (end == list)
+			break;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (; first <= last && count < max; first++) {
+			if (cpus == NULL || cpu_node((int) first) != -2)
+				out[count++] = (int) first;
+		}
+		list = *end == ',' ? end + 1 : end;
+	}
+	return count;
+}
+
+/**
+ * Reads a single integer from a /sys file
+ *
+ * @param path	File to read
+ * @param fallback	Value when the file cannot be read
+ * @return 	The integer
+ */
+
+static int read_sys_int(const char *path, int fallback) {
+	FILE *file = fopen(path, "r");
+	int value = fallback;
+	if (file == NULL)
+		return fallback;
+	if (fscanf(file, "%d", &value) != 1)
+		value = fallback;
+	fclose(file);
+	return value;
+}
+
+/**
+ * Loads the package, core and NUMA node of every online cpu from
+ * /sys/devices/system, falling back to one package and node of
+ * independent cores where a file is missing
+ */
+
+static void load_topology(void) {
+	char path[LINE_LENGTH];
+	char line[LINE_LENGTH * 4];
+	int max = sysconf(_SC_NPROCESSORS_CONF);
+	int *online;
+	FILE *file;
+	int i;
+
+	if (max < 1)
+		max = 1;
+	online = calloc(max, sizeof(int));
+	cpu_count = 0;
+	file = fopen("/sys/devices/system/cpu/online", "r");
+	if (file != NULL) {
+		if (fgets(line, sizeof(line), file) != NULL)
+			cpu_count = parse_cpu_list(line, online, max);
+		fclose(file);
+	}
+	if (cpu_count == 0) {
+		cpu_count = 1;
+		online[0] = 0;
+	}
+	cpus = calloc(cpu_count, sizeof(cpu_info));
+	for (i = 0; i < cpu_count; i++) {
+		cpus[i].cpu = online[i];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", online[i]);
+		cpus[i].package = read_sys_int(path, 0);
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", online[i]);
+		cpus[i].core = read_sys_int(path, online[i]);
+	}
+	free(online);
+
+	//Every node directory lists its cpus
+	DIR *nodes = opendir("/sys/devices/system/node");
+	struct dirent *entry;
+	int *node_cpus = calloc(max, sizeof(int));
+	while (nodes != NULL && (entry = readdir(nodes)) != NULL) {
+		int node;
+		int n;
+		if (sscanf(entry->d_name, "node%d", &node) != 1)
+			continue;
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		file = fopen(path, "r");
+		if (file == NULL)
+			continue;
+		if (fgets(line, sizeof(line), file) != NULL) {
+			n = parse_cpu_list(line, node_cpus, max);
+			for (i = 0; i < n; i++) {
+				int c;
+				for (c = 0; c < cpu_count; c++)
+					if (cpus[c].cpu == node_cpus[i])
+						cpus[c].node = node;
+			}
+		}
+		fclose(file);
 	}
-}
\ No newline at end of file
+	free(node_cpus);
+	if (nodes != NULL)
+		closedir(nodes);
+}
+
+/**
+ * Returns the NUMA node of a cpu
+ *
+ * @param cpu	Cpu number
+ * @return 	Its node, or -2 when the cpu is not online
+ */
+
+static int cpu_node(int cpu) {
+	int i;
+	for (i = 0; i < cpu_count; i++)
+		if (cpus[i].cpu == cpu)
+			return cpus[i].node;
+	return -2;
+}
+
+/**
+ * Orders cpus by package, core and cpu number, putting the hardware
+ * threads of a core next to each other
+ */
+
+static int compare_siblings(const void *a, const void *b) {
+	const cpu_info *x = a;
+	const cpu_info *y = b;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+/**
+ * Orders cpus by package, then hardware thread rank and core, so
+ * neighbours are distinct cores of one package
+ */
+
+static int compare_socket(const void *a, const void *b) {
+	const cpu_info *x = a;
+	const cpu_info *y = b;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	return x->core - y->core;
+}
+
+/**
+ * Orders cpus by their slot within the package, then package, so
+ * neighbours alternate between packages
+ */
+
+static int compare_spread(const void *a, const void *b) {
+	const cpu_info *x = a;
+	const cpu_info *y = b;
+	if (x->slot != y->slot)
+		return x->slot - y->slot;
+	return x->package - y->package;
+}
+
+/**
+ * Builds the cpu order of the selected placement from the topology
+ */
+
+static void build_cpu_order(void) {
+	cpu_info *sorted = calloc(cpu_count, sizeof(cpu_info));
+	int i;
+	memcpy(sorted, cpus, cpu_count * sizeof(cpu_info));
+
+	//Rank the hardware threads of every core
+	qsort(sorted, cpu_count, sizeof(cpu_info), compare_siblings);
+	for (i = 0; i < cpu_count; i++) {
+		int same = i > 0 && sorted[i].package == sorted[i - 1].package
+		           && sorted[i].core == sorted[i - 1].core;
+		sorted[i].rank = same ? sorted[i - 1].rank + 1 : 0;
+	}
+	if (place != PLACE_SIBLINGS) {
+		qsort(sorted, cpu_count, sizeof(cpu_info), compare_socket);
+		for (i = 0; i < cpu_count; i++)
+			sorted[i].slot = i > 0 && sorted[i].package == sorted[i - 1].package ? sorted[i - 1].slot + 1 : 0;
+	}
+	if (place == PLACE_SPREAD)
+		qsort(sorted, cpu_count, sizeof(cpu_info), compare_spread);
+
+	cpu_order = calloc(cpu_count, sizeof(int));
+	for (i = 0; i < cpu_count; i++)
+		cpu_order[i] = sorted[i].cpu;
+	cpu_order_length = cpu_count;
+	free(sorted);
+}
+
+/**
+ * Pins the thread created with attr to the cpu at a slot of the
+ * placement's order, wrapping around when there are more threads
+ * than cpus
+ *
+ * @param attr	Attributes of the thread to be created
+ * @param slot	2k for producer k, 2k + 1 for consumer k
+ * @return 	The cpu, or -1 without a placement
+ */
+
+static int pin_attr(pthread_attr_t *attr, int slot) {
+	cpu_set_t set;
+	if (place == PLACE_NONE)
+		return -1;
+	int cpu = cpu_order[slot % cpu_order_length];
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+	return cpu;
+}
+
+/**
+ * Creates the buffer, and in sharded mode every producer's shard,
+ * on the calling thread
+ *
+ * @param param	Capacity of the buffer and of each shard
+ */
+
+static void *create_buffer(void *param) {
+	long capacity = *(long *) param;
+	int i;
+	buffer = buffer_create(capacity);
+	lanes = calloc(lane_count, sizeof(bounded_buffer *));
+	lanes[0] = buffer;
+	for (i = 1; i < lane_count; i++)
+		lanes[i] = buffer_create(capacity);
+	if (shard_count > 0) {
+		shards = calloc(shard_count, sizeof(bounded_buffer *));
+		for (i = 0; i < shard_count; i++)
+			shards[i] = buffer_create(capacity);
+	}
+	return NULL;
+}
+
+/**
+ * Returns the NUMA node holding the page of an address
+ *
+ * @param address	Address to look up
+ * @return 	The node, or -1 when it cannot be told
+ */
+
+static int address_node(void *address) {
+	int node = -1;
+	if (syscall(SYS_get_mempolicy, &node, NULL, 0, address, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+		return -1;
+	return node;
+}
+
+/**
+ * Returns the slab class of a payload length
+ */
+
+static int slab_class_of(uint32_t length) {
+	int shift = SLAB_MIN_SHIFT;
+	while ((1U << shift) < length)
+		shift++;
+	return shift - SLAB_MIN_SHIFT;
+}
+
+/**
+ * Maps the slab classes holding payloads of min to max bytes,
+ * with every block free. Pages are only backed once a block is
+ * first used.
+ *
+ * @param min	Smallest payload
+ * @param max	Largest payload
+ * @param blocks	Blocks per class
+ */
+
+static void slab_init(uint32_t min, uint32_t max, uint32_t blocks) {
+	int c;
+	uint32_t i;
+	for (c = slab_class_of(min); c <= slab_class_of(max); c++) {
+		slab_class *class = &slab[c];
+		class->block_size = (size_t) 1 << (c + SLAB_MIN_SHIFT);
+		class->blocks = blocks;
+		class->base = mmap(NULL, class->block_size * blocks, PROT_READ | PROT_WRITE,
+		                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		class->next = calloc(blocks, sizeof(atomic_uint));
+		if (class->base == MAP_FAILED || class->next == NULL) {
+			printf("Cannot allocate %u payload blocks of %zu bytes.\n", blocks, class->block_size);
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < blocks; i++)
+			atomic_init(&class->next[i], i + 1 < blocks ? i + 2 : 0);
+		atomic_init(&class->head, 1);
+	}
+}
+
+/**
+ * Pops a free block of the class fitting a payload
+ *
+ * @param length	Payload length
+ * @return 	The block, or NULL when the class has none free
+ */
+
+static void *slab_alloc(uint32_t length) {
+	slab_class *class = &slab[slab_class_of(length)];
+	uint64_t head = atomic_load_explicit(&class->head, memory_order_acquire);
+	while (1) {
+		uint32_t top = (uint32_t) head;
+		if (top == 0)
+			return NULL;
+		uint64_t next = ((head >> 32) + 1) << 32
+		                | atomic_load_explicit(&class->next[top - 1], memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(&class->head, &head, next,
+		                                          memory_order_acquire, memory_order_acquire))
+			return class->base + (size_t) (top - 1) * class->block_size;
+	}
+}
+
+/**
+ * Pushes a block back onto the free stack of its class
+ *
+ * @param data	Block from slab_alloc()
+ * @param length	Payload length it was allocated for
+ */
+
+static void slab_free(void *data, uint32_t length) {
+	slab_class *class = &slab[slab_class_of(length)];
+	uint32_t block = ((char *) data - class->base) / class->block_size + 1;
+	uint64_t head = atomic_load_explicit(&class->head, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&class->next[block - 1], (uint32_t) head, memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak_explicit(&class->head, &head,
+	                                                ((head >> 32) + 1) << 32 | block,
+	                                                memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * Gives an item a payload of a random size, written in place in a
+ * slab block, or written to the producer's own record and copied
+ * into the block for the copy baseline
+ *
+ * @param item	Item to fill
+ * @param rng	Producer's generator
+ * @param record	Producer's record of payload_max bytes
+ */
+
+static void make_payload(buffer_item *item, rng_state *rng, char *record) {
+	item->length = payload_min + rng_next(rng) % (payload_max - payload_min + 1);
+	while ((item->data = slab_alloc(item->length)) == NULL)
+		sched_yield();
+	if (payload_copy) {
+		memset(record, (unsigned char) item->value, item->length);
+		memcpy(item->data, record, item->length);
+	} else {
+		memset(item->data, (unsigned char) item->value, item->length);
+	}
+}
+
+/**
+ * Reads an item's payload in place, or copies it out to the
+ * consumer's own record for the copy baseline, and releases its
+ * block
+ *
+ * @param item	Item removed from the buffer
+ * @param record	Consumer's record of payload_max bytes
+ * @return 	Number of payload bytes, or -1 when they are corrupt
+ */
+
+static long take_payload(buffer_item *item, char *record) {
+	const unsigned char *bytes = item->data;
+	long length = item->length;
+	if (payload_copy) {
+		memcpy(record, item->data, item->length);
+		bytes = (const unsigned char *) record;
+	}
+	if (bytes[0] != (unsigned char) item->value || bytes[length - 1] != (unsigned char) item->value)
+		length = -1;
+	slab_free(item->data, item->length);
+	return length;
+}
+
+/**
+ * Initializes the indices, mutex and semaphores of a zeroed buffer.
+ * A buffer shared between processes gets a robust mutex, so a process
+ * dying in the critical section does not leave the others locked out;
+ * its semaphores are futexes and shared once futex_private is cleared.
+ *
+ * @param b	Buffer to initialize
+ * @param capacity	Number of slots, a power of two
+ * @param size	Bytes mapped for the buffer and its slots
+ * @param shared	Whether other processes map the buffer
+ */
+
+static void buffer_init(bounded_buffer *b, size_t capacity, size_t size, int shared) {
+	pthread_mutexattr_t attr;
+	size_t i;
+	b->capacity = capacity;
+	b->mask = capacity - 1;
+	b->size = size;
+	pthread_mutexattr_init(&attr);
+	if (shared) {
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	}
+	pthread_mutex_init(&b->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	atomic_init(&b->empty.count, capacity);
+	atomic_init(&b->full.count, 0);
+	for (i = 0; i < capacity; i++)
+		atomic_init(&b->slots[i].seq, i);
+}
+
+/**
+ * Locks the buffer's mutex, counting the lock and, when a first try
+ * finds it held, the contended attempt and the time spent waiting.
+ * When its last owner died holding it the indices are still whole,
+ * as they are only stored once the slots are copied, so the mutex
+ * is marked consistent and taken over.
+ *
+ * @param b	Buffer to lock
+ */
+
+static void buffer_lock(bounded_buffer *b) {
+	int result = pthread_mutex_trylock(&b->mutex);
+	if (result == EBUSY) {
+		uint64_t lock_since = now_ns();
+		result = pthread_mutex_lock(&b->mutex);
+		tally(&current->contention.contended, 1);
+		tally(&current->contention.lock_wait_ns, now_ns() - lock_since);
+	}
+	tally(&current->contention.locks, 1);
+	if (result == EOWNERDEAD)
+		pthread_mutex_consistent(&b->mutex);
+}
+
+/**
+ * Maps a page-aligned, zeroed buffer with its slots and initializes
+ * the indices, mutex and semaphores. Its pages are untouched until
+ * then, so they land on the calling thread's NUMA node.
+ *
+ * @param capacity	Number of slots, a power of two
+ * @return 	The empty buffer
+ */
+
+bounded_buffer *buffer_create(size_t capacity) {
+	size_t size = sizeof(bounded_buffer) + capacity * sizeof(buffer_slot);
+	bounded_buffer *b = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (b == MAP_FAILED) {
+		printf("Cannot allocate a buffer of %zu items.\n", capacity);
+		exit(EXIT_FAILURE);
+	}
+	buffer_init(b, capacity, size, 0);
+	return b;
+}
+
+/**
+ * Maps the buffer of a POSIX shared memory object, creating and
+ * initializing it when no process has yet. A process attaching to
+ * an existing buffer waits until its creator marked it ready and
+ * takes its capacity. A buffer left closed with nobody attached is
+ * a leftover of an earlier run and is made anew.
+ *
+ * @param name	Name of the object, without the leading slash
+ * @param capacity	Number of slots when creating, a power of two
+ * @return 	The mapped buffer
+ */
+
+bounded_buffer *buffer_attach(const char *name, size_t capacity) {
+	char path[LINE_LENGTH];
+	size_t size = sizeof(bounded_buffer) + capacity * sizeof(buffer_slot);
+	bounded_buffer *b;
+	struct stat st;
+	snprintf(path, sizeof(path), "/%s", name);
+	while (1) {
+		int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0) {
+			if (ftruncate(fd, size) != 0
+			    || (b = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+				perror(path);
+				shm_unlink(path);
+				exit(EXIT_FAILURE);
+			}
+			close(fd);
+			buffer_init(b, capacity, size, 1);
+			atomic_store(&b->attached, 1);
+			atomic_store(&b->magic, SHARED_MAGIC);
+			return b;
+		}
+		if (errno != EEXIST || (fd = shm_open(path, O_RDWR, 0)) < 0) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+
+		//The creator sizes the object before it maps and fills it
+		while (fstat(fd, &st) == 0 && st.st_size == 0)
+			usleep(1000);
+		b = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (b == MAP_FAILED) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		while (atomic_load(&b->magic) != SHARED_MAGIC)
+			usleep(1000);
+		if (atomic_load(&b->closed) && atomic_load(&b->attached) == 0) {
+			munmap(b, st.st_size);
+			shm_unlink(path);
+			continue;
+		}
+		atomic_fetch_add(&b->attached, 1);
+		return b;
+	}
+}
+
+/**
+ * Unmaps a shared buffer, removing its name once the last process
+ * has detached
+ *
+ * @param b	Buffer from buffer_attach()
+ * @param name	Name it was attached by
+ */
+
+void buffer_detach(bounded_buffer *b, const char *name) {
+	char path[LINE_LENGTH];
+	snprintf(path, sizeof(path), "/%s", name);
+	if (atomic_fetch_sub(&b->attached, 1) == 1)
+		shm_unlink(path);
+	munmap(b, b->size);
+}
+
+/**
+ * Copies items into n slots starting at position pos, wrapping
+ * around the end of the ring
+ *
+ * @param b	Ring to copy into
+ * @param pos	Position of the first slot
+ * @param items	Items to copy
+ * @param n	Number of items
+ */
+
+static void copy_to_slots(bounded_buffer *b, size_t pos, const buffer_item items[], int n) {
+	int i;
+	for (i = 0; i < n; i++)
+		b->slots[(pos + i) & b->mask].item = items[i];
+}
+
+/**
+ * Copies n items out of the slots starting at position pos
+ *
+ * @param b	Ring to copy from
+ * @param pos	Position of the first slot
+ * @param items	Filled with the items
+ * @param n	Number of items
+ */
+
+static void copy_from_slots(bounded_buffer *b, size_t pos, buffer_item items[], int n) {
+	int i;
+	for (i = 0; i < n; i++)
+		items[i] = b->slots[(pos + i) & b->mask].item;
+}
+
+/**
+ * Inserts up to n items into the SPSC ring without waiting and
+ * publishes them with a single store of tail. The producer only
+ * reads the consumer's head when its cached copy says the ring
+ * cannot take all of them.
+ *
+ * @param b	Ring to insert into
+ * @param items	Items to be inserted into the buffer
+ * @param n	Number of items
+ * @return 	Number of items inserted, 0 when the ring is full
+ */
+
+static int spsc_try_insert(bounded_buffer *b, const buffer_item items[], int n) {
+	size_t tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+	size_t free = b->capacity - (tail - b->head_cache);
+	if (free < (size_t) n) {
+		b->head_cache = atomic_load_explicit(&b->head, memory_order_acquire);
+		free = b->capacity - (tail - b->head_cache);
+		if (free < (size_t) n)
+			n = free;
+	}
+	copy_to_slots(b, tail, items, n);
+	atomic_store_explicit(&b->tail, tail + n, memory_order_release);
+	return n;
+}
+
+/**
+ * Removes up to n items from the SPSC ring without waiting and
+ * releases their slots with a single store of head. The consumer
+ * only reads the producer's tail when its cached copy says there
+ * are fewer than n items.
+ *
+ * @param b	Ring to remove from
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove
+ * @return 	Number of items removed, 0 when the ring is empty
+ */
+
+static int spsc_try_remove(bounded_buffer *b, buffer_item items[], int n) {
+	size_t head = atomic_load_explicit(&b->head, memory_order_relaxed);
+	size_t used = b->tail_cache - head;
+	if (used < (size_t) n) {
+		b->tail_cache = atomic_load_explicit(&b->tail, memory_order_acquire);
+		used = b->tail_cache - head;
+		if (used < (size_t) n)
+			n = used;
+	}
+	copy_from_slots(b, head, items, n);
+	atomic_store_explicit(&b->head, head + n, memory_order_release);
+	return n;
+}
+
+/**
+ * Inserts up to n items into the MPMC ring without waiting. A
+ * producer counts the free slots from tail and claims all of them
+ * with one CAS. No other producer can touch a slot below the new
+ * tail and consumers never touch a free slot, so the claimed
+ * slots are filled and published one sequence number each.
+ *
+ * @param b	Ring to insert into
+ * @param items	Items to be inserted into the buffer
+ * @param n	Number of items
+ * @return 	Number of items inserted, 0 when the ring is full
+ */
+
+static int mpmc_try_insert(bounded_buffer *b, const buffer_item items[], int n) {
+	size_t pos = atomic_load_explicit(&b->tail, memory_order_relaxed);
+	int i;
+	while (1) {
+		int count = 0;
+		while (count < n) {
+			buffer_slot *slot = &b->slots[(pos + count) & b->mask];
+			if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + count)
+				break;
+			count++;
+		}
+		if (count == 0) {
+			size_t seq = atomic_load_explicit(&b->slots[pos & b->mask].seq, memory_order_acquire);
+			//A slot still a lap behind means the ring is full
+			if ((intptr_t) seq - (intptr_t) pos < 0)
+				return 0;
+			pos = atomic_load_explicit(&b->tail, memory_order_relaxed);
+			continue;
+		}
+		if (atomic_compare_exchange_weak_explicit(&b->tail, &pos, pos + count,
+		                                          memory_order_relaxed, memory_order_relaxed)) {
+			for (i = 0; i < count; i++) {
+				buffer_slot *slot = &b->slots[(pos + i) & b->mask];
+				slot->item = items[i];
+				atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+			}
+			return count;
+		}
+	}
+}
+
+/**
+ * Removes up to n items from the MPMC ring without waiting. A
+ * consumer counts the filled slots from head, claims them with one
+ * CAS and hands each back to producers one lap ahead once its item
+ * is read.
+ *
+ * @param b	Ring to remove from
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove
+ * @return 	Number of items removed, 0 when the ring is empty
+ */
+
+static int mpmc_try_remove(bounded_buffer *b, buffer_item items[], int n) {
+	size_t pos = atomic_load_explicit(&b->head, memory_order_relaxed);
+	int i;
+	while (1) {
+		int count = 0;
+		while (count < n) {
+			buffer_slot *slot = &b->slots[(pos + count) & b->mask];
+			if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + count + 1)
+				break;
+			count++;
+		}
+		if (count == 0) {
+			size_t seq = atomic_load_explicit(&b->slots[pos & b->mask].seq, memory_order_acquire);
+			//A slot not yet filled for this lap means the ring is empty
+			if ((intptr_t) seq - (intptr_t) (pos + 1) < 0)
+				return 0;
+			pos = atomic_load_explicit(&b->head, memory_order_relaxed);
+			continue;
+		}
+		if (atomic_compare_exchange_weak_explicit(&b->head, &pos, pos + count,
+		                                          memory_order_relaxed, memory_order_relaxed)) {
+			for (i = 0; i < count; i++) {
+				buffer_slot *slot = &b->slots[(pos + i) & b->mask];
+				items[i] = slot->item;
+				atomic_store_explicit(&slot->seq, pos + i + b->capacity, memory_order_release);
+			}
+			return count;
+		}
+	}
+}
+
+/**
+ * Tries the ring of the selected mode
+ *
+ * @param b	Ring to insert into
+ * @param items	Items to be inserted into the buffer
+ * @param n	Number of items
+ * @return 	Number of items inserted
+ */
+
+static int ring_try_insert(bounded_buffer *b, const buffer_item items[], int n) {
+	return mode == MODE_SPSC ? spsc_try_insert(b, items, n) : mpmc_try_insert(b, items, n);
+}
+
+/**
+ * Tries the ring of the selected mode
+ *
+ * @param b	Ring to remove from
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove
+ * @return 	Number of items removed
+ */
+
+static int ring_try_remove(bounded_buffer *b, buffer_item items[], int n) {
+	return mode == MODE_SPSC ? spsc_try_remove(b, items, n) : mpmc_try_remove(b, items, n);
+}
+
+/**
+ * Tells the CPU the thread is in a spin loop
+ */
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Adds to a counter only the calling thread writes, without a
+ * locked instruction
+ *
+ * @param counter	Counter of the calling thread
+ * @param n	Amount to add
+ */
+
+static inline void tally(atomic_long *counter, long n) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ * Starts a wait on a full or empty buffer. Reading the clock twice
+ * a wait would cost as much as a short wait, so only every
+ * WAIT_SAMPLE-th wait is timed.
+ *
+ * @param full	Whether the buffer is full rather than empty
+ * @return 	Start of the wait in ns, or 1 when it is not timed
+ */
+
+static inline uint64_t wait_begins(int full) {
+	contention_stats *c = &current->contention;
+	long waits = atomic_load_explicit(full ? &c->full_waits : &c->empty_waits, memory_order_relaxed);
+	return waits % WAIT_SAMPLE == 0 ? now_ns() : 1;
+}
+
+/**
+ * Counts a wait on a full or empty buffer. A timed wait stands for
+ * the WAIT_SAMPLE waits around it.
+ *
+ * @param full	Whether the buffer was full rather than empty
+ * @param since	What wait_begins() returned, 0 when the thread never waited
+ */
+
+static inline void count_wait(int full, uint64_t since) {
+	if (since == 0)
+		return;
+	contention_stats *c = &current->contention;
+	tally(full ? &c->full_waits : &c->empty_waits, 1);
+	if (since > 1)
+		tally(full ? &c->full_wait_ns : &c->empty_wait_ns, (now_ns() - since) * WAIT_SAMPLE);
+}
+
+/**
+ * Adds the fill of a buffer to the calling thread's occupancy
+ * histogram once every OCCUPANCY_PERIOD calls
+ *
+ * @param b	Buffer to look at, none for the pipe
+ */
+
+static inline void sample_occupancy(bounded_buffer *b) {
+	contention_stats *c = &current->contention;
+	if (b == NULL || ++c->calls % OCCUPANCY_PERIOD != 0)
+		return;
+	size_t used = atomic_load_explicit(&b->tail, memory_order_relaxed)
+	              - atomic_load_explicit(&b->head, memory_order_relaxed);
+	if (used > b->capacity)
+		used = b->capacity;
+	tally(&c->occupancy[used * (OCCUPANCY_BUCKETS - 1) / b->capacity], 1);
+}
+
+/**
+ * Returns whether a producer may find a free slot
+ *
+ * @param b	Buffer to look at
+ */
+
+static int buffer_has_room(bounded_buffer *b) {
+	return atomic_load_explicit(&b->tail, memory_order_relaxed)
+	       - atomic_load_explicit(&b->head, memory_order_relaxed) < b->capacity;
+}
+
+/**
+ * Returns whether a consumer may find an item, or should give up
+ * because the producers are done
+ *
+ * @param b	Buffer to look at
+ */
+
+static int buffer_has_items(bounded_buffer *b) {
+	return atomic_load_explicit(&b->tail, memory_order_relaxed)
+	       != atomic_load_explicit(&b->head, memory_order_relaxed)
+	       || atomic_load(&producers_done);
+}
+
+/**
+ * Returns whether any shard holds an item
+ */
+
+static int shards_used(void) {
+	int i;
+	for (i = 0; i < shard_count; i++)
+		if (atomic_load(&shards[i]->tail) != atomic_load(&shards[i]->head))
+			return 1;
+	return 0;
+}
+
+/**
+ * Returns whether any shard may hold an item, or consumers should
+ * give up because the producers are done
+ *
+ * @param b	Unused, every shard is looked at
+ */
+
+static int shards_have_items(bounded_buffer *b) {
+	(void) b;
+	return shards_used() || atomic_load(&producers_done);
+}
+
+/**
+ * Waits once after a failed try with the selected strategy, for no
+ * longer than a deadline. A parking thread registers as a waiter,
+ * then checks ready() again so a post made before it registered is
+ * never missed, and sleeps on the event's futex until the sequence
+ * number moves or the deadline passes.
+ *
+ * @param event	Futex of the side to wait on
+ * @param ready	Whether a retry may succeed
+ * @param b	Buffer ready() looks at
+ * @param spins	Tries made so far in this wait
+ * @param deadline	Monotonic time in ns to wake by, 0 for none
+ */
+
+static void wait_until(wait_event *event, int (*ready)(bounded_buffer *), bounded_buffer *b, int *spins,
+                       uint64_t deadline) {
+	struct timespec timeout;
+	if (strategy == WAIT_BLOCK) {
+		sched_yield();
+		return;
+	}
+	if (strategy == WAIT_SPIN || (*spins)++ < spin_limit) {
+		cpu_relax();
+		return;
+	}
+	if (strategy == WAIT_YIELD) {
+		sched_yield();
+		return;
+	}
+	if (deadline != 0) {
+		uint64_t now = now_ns();
+		uint64_t left = deadline > now ? deadline - now : 0;
+		timeout.tv_sec = left / 1000000000;
+		timeout.tv_nsec = left % 1000000000;
+	}
+	unsigned int seq = atomic_load(&event->seq);
+	atomic_fetch_add(&event->waiters, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!ready(b)) {
+		syscall(SYS_futex, &event->seq, FUTEX_WAIT | futex_private, seq, deadline != 0 ? &timeout : NULL, NULL, 0);
+		current->parks++;
+	}
+	atomic_fetch_sub(&event->waiters, 1);
+}
+
+/**
+ * Waits once after a failed try with the selected strategy
+ *
+ * @param event	Futex of the side to wait on
+ * @param ready	Whether a retry may succeed
+ * @param b	Buffer ready() looks at
+ * @param spins	Tries made so far in this wait
+ */
+
+static void wait_once(wait_event *event, int (*ready)(bounded_buffer *), bounded_buffer *b, int *spins) {
+	wait_until(event, ready, b, spins, 0);
+}
+
+/**
+ * Wakes up to n threads parked on an event. Without parked threads
+ * this is a fence and a load, no syscall.
+ *
+ * @param event	Futex of the side that can now make progress
+ * @param n	Most threads to wake
+ */
+
+static void wake_waiters(wait_event *event, int n) {
+	if (strategy != WAIT_PARK)
+		return;
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&event->waiters, memory_order_relaxed) == 0)
+		return;
+	atomic_fetch_add(&event->seq, 1);
+	syscall(SYS_futex, &event->seq, FUTEX_WAKE | futex_private, n, NULL, NULL, 0);
+	if (current != NULL)
+		current->wakeups++;
+}
+
+/**
+ * Takes between 1 and n permits of a semaphore in one compare-and-swap,
+ * sleeping on its futex while it has none. A sleeper registers before
+ * the kernel checks that count is still 0, and give_permits() adds
+ * before it looks for sleepers, so a give is never missed.
+ *
+ * @param sem	Semaphore to take from
+ * @param n	Most permits to take, at least 1
+ * @param full	Whether the caller waits for room rather than items
+ * @param since	Set by wait_begins() the first time the caller sleeps
+ * @return 	Number of permits taken
+ */
+
+static int take_permits(batch_semaphore *sem, int n, int full, uint64_t *since) {
+	unsigned int count = atomic_load_explicit(&sem->count, memory_order_relaxed);
+	unsigned int take;
+	while (1) {
+		if (count == 0) {
+			if (*since == 0)
+				*since = wait_begins(full);
+			atomic_fetch_add(&sem->waiters, 1);
+			syscall(SYS_futex, &sem->count, FUTEX_WAIT | futex_private, 0, NULL, NULL, 0);
+			atomic_fetch_sub(&sem->waiters, 1);
+			count = atomic_load_explicit(&sem->count, memory_order_relaxed);
+			continue;
+		}
+		take = count < (unsigned int) n ? count : (unsigned int) n;
+		if (atomic_compare_exchange_weak(&sem->count, &count, count - take))
+			return (int) take;
+	}
+}
+
+/**
+ * Gives n permits back to a semaphore in one add, waking up to n
+ * sleepers only when there are any
+ *
+ * @param sem	Semaphore to give to
+ * @param n	Permits to give
+ */
+
+static void give_permits(batch_semaphore *sem, int n) {
+	if (n <= 0)
+		return;
+	atomic_fetch_add(&sem->count, n);
+	if (atomic_load(&sem->waiters) > 0)
+		syscall(SYS_futex, &sem->count, FUTEX_WAKE | futex_private, n, NULL, NULL, 0);
+}
+
+/**
+ * Signals ready_fd after an insert unless the signal is already
+ * armed. The fence orders the insert before the look at the flag,
+ * as a sleeping consumer disarms it before its last look at the ring.
+ */
+
+static void signal_ready(void) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&ready_signaled, memory_order_relaxed)
+	    || atomic_exchange(&ready_signaled, 1))
+		return;
+	atomic_store_explicit(&ready_signal_ns, now_ns(), memory_order_relaxed);
+	if (write(ready_fd, &(uint64_t) { 1 }, sizeof(uint64_t)) < 0)
+		perror("write");
+}
+
+/**
+ * Registers ready_fd and stop_fd with a new epoll instance of the
+ * calling consumer. ready_fd is exclusive, so a signal wakes one
+ * sleeping consumer rather than all of them.
+ *
+ * @return 	The epoll file descriptor
+ */
+
+static int ready_epoll(void) {
+	struct epoll_event ready = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = ready_fd };
+	struct epoll_event stopped = { .events = EPOLLIN, .data.fd = stop_fd };
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ready_fd, &ready) != 0
+	    || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &stopped) != 0) {
+		perror("epoll");
+		exit(EXIT_FAILURE);
+	}
+	return epoll_fd;
+}
+
+/**
+ * Waits in the calling consumer's epoll loop until ready_fd or
+ * stop_fd is readable. The consumer drops a signal left from while
+ * it was busy and disarms the signal, then checks ready() again so
+ * an insert made before it disarmed is never missed. The fence pairs
+ * with the one in signal_ready(): either the consumer sees the item
+ * or the producer sees the signal disarmed and writes. Consuming the
+ * signal records the time from its write to the wakeup.
+ *
+ * @param ready	Whether a retry may succeed
+ * @param b	Buffer ready() looks at
+ */
+
+static void wait_readable(int (*ready)(bounded_buffer *), bounded_buffer *b) {
+	struct epoll_event events[2];
+	uint64_t value;
+	int n;
+	int i;
+	if (read(ready_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+		perror("read");
+	atomic_store(&ready_signaled, 0);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (ready(b))
+		return;
+	while ((n = epoll_wait(current->epoll_fd, events, 2, -1)) < 0 && errno == EINTR)
+		;
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd != ready_fd || read(ready_fd, &value, sizeof(value)) != sizeof(value))
+			continue;
+		uint64_t latency = now_ns() - atomic_load_explicit(&ready_signal_ns, memory_order_relaxed);
+		current->wake_latency[latency_bucket(latency)]++;
+		if (latency > current->max_wake_latency)
+			current->max_wake_latency = latency;
+		current->wakes++;
+	}
+}
+
+/**
+ * Returns whether any priority lane holds an item
+ */
+
+static int lanes_used(void) {
+	int i;
+	for (i = 0; i < lane_count; i++)
+		if (atomic_load(&lanes[i]->tail) != atomic_load(&lanes[i]->head))
+			return 1;
+	return 0;
+}
+
+/**
+ * Returns whether any lane may hold an item, or consumers should
+ * give up because the producers are done
+ *
+ * @param b	Unused, every lane is looked at
+ */
+
+static int lanes_have_items(bounded_buffer *b) {
+	(void) b;
+	return lanes_used() || atomic_load(&producers_done);
+}
+
+/**
+ * Removes up to n items from the priority lanes in the lane order.
+ * STRICT tries the lanes from the most urgent. WEIGHTED goes on
+ * taking from the lane where the thread left off until it took the
+ * lane's weight in items or found it empty, then moves to the next.
+ *
+ * @param items	Filled with the removed items, all from one lane
+ * @param n	Most items to remove
+ * @return 	Number of items removed, 0 if every lane was empty
+ */
+
+static int lanes_try_remove(buffer_item items[], int n) {
+	static _Thread_local int cursor = -1;
+	static _Thread_local int credit;
+	int count;
+	int i;
+	if (order == LANES_STRICT) {
+		for (i = 0; i < lane_count; i++)
+			if ((count = ring_try_remove(lanes[i], items, n)) > 0)
+				return count;
+		return 0;
+	}
+	for (i = 0; i <= lane_count; i++) {
+		if (credit == 0) {
+			cursor = (cursor + 1) % lane_count;
+			credit = lane_weights[cursor];
+		}
+		if ((count = ring_try_remove(lanes[cursor], items, n < credit ? n : credit)) > 0) {
+			credit -= count;
+			return count;
+		}
+		credit = 0;
+	}
+	return 0;
+}
+
+/**
+ * Makes room in a full mpmc ring by removing its oldest item,
+ * releasing its payload and counting it as dropped
+ *
+ * @param b	Ring to drop from
+ */
+
+static void drop_oldest(bounded_buffer *b) {
+	buffer_item victim;
+	if (mpmc_try_remove(b, &victim, 1) == 0)
+		return;
+	if (victim.data != NULL)
+		slab_free(victim.data, victim.length);
+	current->per_lane[victim.lane].dropped++;
+	atomic_fetch_add(&dropped_items, 1);
+}
+
+/**
+ * Inserts up to n items under the mutex without the semaphores,
+ * waiting for a free slot with the selected strategy
+ *
+ * @param items	Items to be inserted into the buffer
+ * @param n	Number of items, at least 1
+ * @return 	Number of items inserted, at least 1
+ */
+
+static int locked_insert(const buffer_item items[], int n) {
+	int spins = 0;
+	int count = 0;
+	uint64_t since = 0;
+	while (count == 0) {
+		while (!buffer_has_room(buffer)) {
+			if (since == 0)
+				since = wait_begins(1);
+			wait_once(&buffer->not_full, buffer_has_room, buffer, &spins);
+		}
+		buffer_lock(buffer);
+		size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+		size_t free = buffer->capacity - (tail - atomic_load_explicit(&buffer->head, memory_order_relaxed));
+		count = free < (size_t) n ? (int) free : n;
+		copy_to_slots(buffer, tail, items, count);
+		atomic_store_explicit(&buffer->tail, tail + count, memory_order_relaxed);
+		pthread_mutex_unlock(&buffer->mutex);
+	}
+	count_wait(1, since);
+	return count;
+}
+
+/**
+ * Removes up to n items under the mutex without the semaphores,
+ * waiting for an item with the selected strategy
+ *
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove, at least 1
+ * @return 	Number of items removed, or 0 once the producers
+ * 		are done and the buffer is empty
+ */
+
+static int locked_remove(buffer_item items[], int n) {
+	int spins = 0;
+	int count = 0;
+	uint64_t since = 0;
+	while (count == 0) {
+		while (!buffer_has_items(buffer)) {
+			if (since == 0)
+				since = wait_begins(0);
+			wait_once(&buffer->not_empty, buffer_has_items, buffer, &spins);
+		}
+		buffer_lock(buffer);
+		size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+		size_t used = atomic_load_explicit(&buffer->tail, memory_order_relaxed) - head;
+		count = used < (size_t) n ? (int) used : n;
+		copy_from_slots(buffer, head, items, count);
+		atomic_store_explicit(&buffer->head, head + count, memory_order_relaxed);
+		pthread_mutex_unlock(&buffer->mutex);
+		if (count == 0 && atomic_load(&producers_done))
+			return 0;
+	}
+	count_wait(0, since);
+	return count;
+}
+
+/**
+ * Removes up to n items from a shard if no other consumer holds
+ * its consumer lock. The lock keeps the shard's single-consumer
+ * side to one thread at a time, so items leave in FIFO order.
+ *
+ * @param s	Shard index
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove
+ * @return 	Number of items removed
+ */
+
+static int shard_try_remove(int s, buffer_item items[], int n) {
+	bounded_buffer *b = shards[s];
+	int count;
+	if (atomic_load_explicit(&b->consumer_lock, memory_order_relaxed)
+	    || atomic_exchange_explicit(&b->consumer_lock, 1, memory_order_acquire))
+		return 0;
+	count = spsc_try_remove(b, items, n);
+	atomic_store_explicit(&b->consumer_lock, 0, memory_order_release);
+	if (count > 0)
+		wake_waiters(&b->not_full, 1);
+	return count;
+}
+
+/**
+ * Removes up to n items from the shards in the order of the
+ * fairness policy. Consumer c is home to the shards s with
+ * s % consumers == c and steals from the others:
+ *
+ * HOME drains the home shards in turn and steals only when they
+ * are all empty, ROUND_ROBIN moves on to the next shard after every
+ * removal and LONGEST takes the shard with the most items first.
+ *
+ * @param c	Consumer index
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove
+ * @return 	Number of items removed, 0 when every shard is empty
+ */
+
+static int sharded_try_remove(int c, buffer_item items[], int n) {
+	static _Thread_local int cursor;
+	int count;
+	int i;
+
+	if (fairness == FAIR_LONGEST) {
+		int longest = -1;
+		size_t most = 0;
+		for (i = 0; i < shard_count; i++) {
+			size_t used = atomic_load_explicit(&shards[i]->tail, memory_order_relaxed)
+			              - atomic_load_explicit(&shards[i]->head, memory_order_relaxed);
+			if (used > most) {
+				most = used;
+				longest = i;
+			}
+		}
+		if (longest >= 0 && (count = shard_try_remove(longest, items, n)) > 0) {
+			if (longest % consumer_count != c)
+				current->steals++;
+			return count;
+		}
+	}
+
+	//Home shards first, from where the last removal left off
+	if (fairness == FAIR_HOME) {
+		int homes = (shard_count - c + consumer_count - 1) / consumer_count;
+		for (i = 0; i < homes; i++) {
+			int s = c + ((cursor + i) % homes) * consumer_count;
+			if ((count = shard_try_remove(s, items, n)) > 0) {
+				cursor = (cursor + i) % homes;
+				return count;
+			}
+		}
+	}
+
+	//Every shard in turn from the consumer's place, so consumers
+	//starting out do not all pile onto shard 0
+	for (i = 0; i < shard_count; i++) {
+		int s = (c + cursor + i) % shard_count;
+		if (fairness == FAIR_HOME && s % consumer_count == c)
+			continue;
+		if ((count = shard_try_remove(s, items, n)) > 0) {
+			if (fairness == FAIR_ROUND_ROBIN)
+				cursor = (cursor + i + 1) % shard_count;
+			if (s % consumer_count != c)
+				current->steals++;
+			return count;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes up to n items to the pipe in one write. Writes of at most
+ * PIPE_BUF bytes are atomic, so items never interleave.
+ *
+ * @param items	Items to be written
+ * @param n	Number of items
+ * @return 	Number of items written
+ */
+
+static int pipe_insert(const buffer_item items[], int n) {
+	if ((size_t) n > PIPE_BUF / sizeof(buffer_item))
+		n = PIPE_BUF / sizeof(buffer_item);
+	if (write(pipe_fds[1], items, n * sizeof(buffer_item)) < 0) {
+		perror("write");
+		exit(EXIT_FAILURE);
+	}
+	return n;
+}
+
+/**
+ * Reads up to n items from the pipe in one read. The pipe only
+ * ever holds whole items, so a read never splits one.
+ *
+ * @param items	Filled with the items read
+ * @param n	Most items to read
+ * @return 	Number of items read, 0 once the write end is closed
+ * 		and the pipe is empty
+ */
+
+static int pipe_remove(buffer_item items[], int n) {
+	ssize_t length;
+	if ((size_t) n > PIPE_BUF / sizeof(buffer_item))
+		n = PIPE_BUF / sizeof(buffer_item);
+	while ((length = read(pipe_fds[0], items, n * sizeof(buffer_item))) < 0 && errno == EINTR)
+		;
+	return length > 0 ? (int) (length / sizeof(buffer_item)) : 0;
+}
+
+/**
+ * Inserts up to n items into the buffer in one synchronization:
+ * one take of up to n free slots from the semaphore, one pass through
+ * the mutex and one give of the filled slots, or one claim of the
+ * lock-free ring of the selected mode. A full buffer is waited out
+ * with the selected strategy and consumers parked on an empty one
+ * are woken.
+ *
+ * @param items	Items to be inserted into the buffer
+ * @param n	Number of items, at least 1
+ * @param param	Locally generated thread ID 
+ * @return 	Number of items inserted, at least 1
+ */
+
+int insert_items(buffer_item items[], int n, void *param) {
+	int id = (int) (intptr_t) param;
+	bounded_buffer *b = mode == MODE_SHARDED ? shards[id - 1] : mode == MODE_PIPE ? NULL : lanes[items[0].lane];
+	uint64_t since = 0;
+	uint64_t deadline = 0;
+	int spins = 0;
+	int count;
+	int i;
+	if (mode == MODE_SHARDED) {
+		while ((count = spsc_try_insert(b, items, n)) == 0) {
+			if (since == 0)
+				since = wait_begins(1);
+			wait_once(&b->not_full, buffer_has_room, b, &spins);
+		}
+	} else if (mode == MODE_PIPE) {
+		count = pipe_insert(items, n);
+	} else if (mode != MODE_MUTEX) {
+		while ((count = ring_try_insert(b, items, n)) == 0) {
+			if (policy == FULL_FAIL)
+				return -1;
+			if (policy == FULL_DROP_OLDEST) {
+				drop_oldest(b);
+				continue;
+			}
+			if (since == 0)
+				since = wait_begins(1);
+			if (policy == FULL_TIMEOUT) {
+				uint64_t now = now_ns();
+				if (deadline == 0) {
+					deadline = now + full_timeout_us * 1000;
+				} else if (now >= deadline) {
+					count_wait(1, since);
+					return -1;
+				}
+			}
+			wait_until(&b->not_full, buffer_has_room, b, &spins, deadline);
+		}
+	} else if (strategy != WAIT_BLOCK) {
+		count = locked_insert(items, n);
+	} else {
+		count = take_permits(&buffer->empty, n, 1, &since);
+		buffer_lock(buffer);
+		size_t tail = atomic_load_explicit(&buffer->tail, memory_order_relaxed);
+		copy_to_slots(buffer, tail, items, count);
+		atomic_store_explicit(&buffer->tail, tail + count, memory_order_relaxed);
+		pthread_mutex_unlock(&buffer->mutex);
+		give_permits(&buffer->full, count);
+	}
+	count_wait(1, since);
+	sample_occupancy(b);
+	current->per_lane[items[0].lane].inserted += count;
+	wake_waiters(mode == MODE_SHARDED ? &shard_event : lane_count > 1 ? &lane_event : &lanes[0]->not_empty, count);
+	if (ready_fd >= 0)
+		signal_ready();
+	if (logging)
+		for (i = 0; i < count; i++)
+			log_item(id, items[i].value, 0);
+	return count;
+}
+
+/**
+ * Removes up to n items from the buffer in one synchronization,
+ * the same way as insert_items(), waiting out an empty buffer
+ *
+ * @param items	Filled with the removed items
+ * @param n	Most items to remove, at least 1
+ * @param param	Locally generated thread ID 
+ * @return 	Number of items removed, or -1 once the producers
+ * 		are done and the buffer is empty
+ */
+
+int remove_items(buffer_item items[], int n, void *param) {
+	int id = (int) (intptr_t) param;
+	uint64_t since = 0;
+	int spins = 0;
+	int count;
+	int i;
+	if (mode == MODE_SHARDED) {
+		while ((count = sharded_try_remove(id - 1, items, n)) == 0) {
+			//A shard locked by another consumer may still hold items,
+			//so give up only once no shard does
+			if (atomic_load(&producers_done) && !shards_used())
+				return -1;
+			if (since == 0)
+				since = wait_begins(0);
+			wait_once(&shard_event, shards_have_items, NULL, &spins);
+		}
+	} else if (mode == MODE_PIPE) {
+		if ((count = pipe_remove(items, n)) == 0)
+			return -1;
+	} else if (lane_count > 1) {
+		while ((count = lanes_try_remove(items, n)) == 0) {
+			//Every insert is visible once producers_done is
+			if (atomic_load(&producers_done) && !lanes_used())
+				return -1;
+			if (since == 0)
+				since = wait_begins(0);
+			if (ready_fd >= 0)
+				wait_readable(lanes_have_items, NULL);
+			else
+				wait_once(&lane_event, lanes_have_items, NULL, &spins);
+		}
+	} else if (mode != MODE_MUTEX) {
+		while ((count = ring_try_remove(buffer, items, n)) == 0) {
+			//Every insert is visible once producers_done is, so check the ring again
+			if (atomic_load(&producers_done)) {
+				if ((count = ring_try_remove(buffer, items, n)) != 0)
+					break;
+				return -1;
+			}
+			if (since == 0)
+				since = wait_begins(0);
+			if (ready_fd >= 0)
+				wait_readable(buffer_has_items, buffer);
+			else
+				wait_once(&buffer->not_empty, buffer_has_items, buffer, &spins);
+		}
+	} else if (strategy != WAIT_BLOCK) {
+		if ((count = locked_remove(items, n)) == 0)
+			return -1;
+	} else {
+		int permits = take_permits(&buffer->full, n, 0, &since);
+		buffer_lock(buffer);
+		size_t head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+		size_t used = atomic_load_explicit(&buffer->tail, memory_order_relaxed) - head;
+		count = used < (size_t) permits ? (int) used : permits;
+		copy_from_slots(buffer, head, items, count);
+		for (i = 0; i < count; i++)
+			memset(&buffer->slots[(head + i) & buffer->mask].item, 0, sizeof(buffer_item));
+		atomic_store_explicit(&buffer->head, head + count, memory_order_relaxed);
+		pthread_mutex_unlock(&buffer->mutex);
+		//Permits without an item are the posts made to wake consumers
+		//at the end, keep one and hand the rest on to the other consumers
+		if (count == 0) {
+			give_permits(&buffer->full, permits - 1);
+			return -1;
+		}
+		give_permits(&buffer->full, permits - count);
+		give_permits(&buffer->empty, count);
+	}
+	count_wait(0, since);
+	sample_occupancy(mode == MODE_PIPE || mode == MODE_SHARDED ? NULL : lanes[items[0].lane]);
+	current->per_lane[items[0].lane].removed += count;
+	if (mode != MODE_SHARDED)
+		wake_waiters(&lanes[items[0].lane]->not_full, count);
+	if (logging)
+		for (i = 0; i < count; i++)
+			log_item(id, items[i].value, 1);
+	return count;
+}
+
+/**
+ * Inserts a single item into the buffer
+ *
+ * @param item 	Random number to be inserted into the buffer
+ * @param param	Locally generated thread ID 
+ * @return 	0 on success, -1 on error
+ */
+
+int insert_item(buffer_item item, void *param) {
+	return insert_items(&item, 1, param) == 1 ? 0 : -1;
+}
+
+/**
+ * Removes a single item from the buffer
+ *
+ * @param item 	Filled with the removed item
+ * @param param	Locally generated thread ID 
+ * @return 	0 on success, -1 once the producers are done
+ * 		and the buffer is empty
+ */
+
+int remove_item(buffer_item *item, void *param) {
+	return remove_items(item, 1, param) == 1 ? 0 : -1;
+}
+
+/**
+ * Inserts a burst of items, all of one lane. Items the full-buffer
+ * policy rejects are counted against the lane and their payloads
+ * released.
+ *
+ * @param self	Statistics of the calling producer
+ * @param items	Items to be inserted
+ * @param n	Number of items
+ * @param id	Locally generated thread ID
+ * @return 	Number of items inserted
+ */
+
+static int insert_burst(thread_stats *self, buffer_item items[], int n, void *id) {
+	int done = 0;
+	int count;
+	int i;
+	while (done < n) {
+		if ((count = insert_items(items + done, n - done, id)) < 0) {
+			for (i = done; i < n; i++)
+				if (items[i].data != NULL)
+					slab_free(items[i].data, items[i].length);
+			self->per_lane[items[0].lane].rejected += n - done;
+			break;
+		}
+		done += count;
+	}
+	return done;
+}
+
+/**
+ * Creates a burst of batch random numbers to insert into the buffer.
+ * In benchmark mode items are numbered and stamped instead, back
+ * to back. With lanes each burst goes to a lane drawn at random.
+ *
+ * @param param	Thread statistics holding the locally generated thread ID 
+ */
+
+void *producer(void *param) {
+	thread_stats *self = param;
+	void *id = (void *) (intptr_t) self->id;
+	buffer_item *items = calloc(batch, sizeof(buffer_item));
+	char *record = payload_copy ? malloc(payload_max) : NULL;
+	long made = 0;
+	int i;
+	current = self;
+	self->cpu = sched_getcpu();
+	
+	if (benchmark) {
+		self->start_ns = now_ns();
+		while (!atomic_load_explicit(&stop, memory_order_relaxed)
+		       && (items_per_producer == 0 || made < items_per_producer)) {
+			int n = batch;
+			uint32_t lane = lane_count > 1 ? rng_next(&self->rng) % lane_count : 0;
+			if (items_per_producer != 0 && items_per_producer - made < n)
+				n = items_per_producer - made;
+			for (i = 0; i < n; i++) {
+				items[i].value = made + i;
+				items[i].lane = lane;
+				if (payload_max > 0) {
+					make_payload(&items[i], &self->rng, record);
+					self->bytes += items[i].length;
+				}
+			}
+			uint64_t stamp = now_ns();
+			for (i = 0; i < n; i++)
+				items[i].stamp = stamp;
+			self->ops += insert_burst(self, items, n, id);
+			made += n;
+		}
+		self->end_ns = now_ns();
+		free(items);
+		free(record);
+		return NULL;
+	}
+	
+	//A stop during the nap leaves the next burst unmade, one during
+	//the insert lets it finish
+	while (1) {
+		uint32_t lane;
+		nap(draw_delay(&arrival, self));
+		if (atomic_load(&stop))
+			break;
+		lane = lane_count > 1 ? rng_next(&self->rng) % lane_count : 0;
+		for (i = 0; i < batch; i++) {
+			items[i].value = (int) (rng_next(&self->rng) >> 33);
+			items[i].lane = lane;
+			if (payload_max > 0)
+				make_payload(&items[i], &self->rng, record);
+		}
+		atomic_fetch_add(&produced_items, insert_burst(self, items, batch, id));
+	}
+	free(items);
+	free(record);
+	return NULL;
+}
+
+/**
+ * Removes up to batch numbers from the buffer. In benchmark mode items are
+ * removed back to back and their latency recorded until the
+ * producers are done and the buffer is drained.
+ *
+ * @param param	Thread statistics holding the locally generated thread ID 
+ */
+ 
+void *consumer(void *param) {
+	thread_stats *self = param;
+	void *id = (void *) (intptr_t) self->id;
+	buffer_item *items = calloc(batch, sizeof(buffer_item));
+	char *record = payload_copy ? malloc(payload_max) : NULL;
+	int count;
+	int i;
+	current = self;
+	self->cpu = sched_getcpu();
+	if (ready_fd >= 0)
+		self->epoll_fd = ready_epoll();
+	
+	if (benchmark) {
+		self->start_ns = now_ns();
+		while ((count = remove_items(items, batch, id)) > 0) {
+			uint64_t now = now_ns();
+			for (i = 0; i < count; i++) {
+				uint64_t latency = now - items[i].stamp;
+				self->latency[latency_bucket(latency)]++;
+				if (latency > self->max_latency)
+					self->max_latency = latency;
+				if (self->per_lane[items[i].lane].latency != NULL) {
+					lane_stats *lane = &self->per_lane[items[i].lane];
+					lane->latency[latency_bucket(latency)]++;
+					if (latency > lane->max_latency)
+						lane->max_latency = latency;
+				}
+				if (payload_max > 0) {
+					long bytes = take_payload(&items[i], record);
+					if (bytes < 0)
+						printf("consumer %d got a corrupt payload for %d\n", self->id, items[i].value);
+					else
+						self->bytes += bytes;
+				}
+			}
+			self->ops += count;
+		}
+		self->end_ns = now_ns();
+		free(items);
+		free(record);
+		if (ready_fd >= 0)
+			close(self->epoll_fd);
+		return NULL;
+	}
+	
+	//Naps end at once after a stop, so the buffer drains back to back
+	while (1) {
+		nap(draw_delay(&service, self));
+		if ((count = remove_items(items, batch, id)) < 0)
+			break;
+		for (i = 0; i < count && payload_max > 0; i++)
+			if (take_payload(&items[i], record) < 0)
+				printf("consumer %d got a corrupt payload for %d\n", self->id, items[i].value);
+		atomic_fetch_add(&consumed_items, count);
+	}
+	free(items);
+	free(record);
+	if (ready_fd >= 0)
+		close(self->epoll_fd);
+	return NULL;
+}
+
+/**
+ * Prints a latency histogram's percentiles as CSV columns
+ *
+ * @param latency	Histogram to read
+ * @param total	Number of latencies in the histogram
+ * @param max	Largest latency seen
+ */
+
+static void print_percentiles(long *latency, long total, uint64_t max) {
+	static const double quantiles[] = { 0.50, 0.90, 0.99, 0.999 };
+	int q;
+	int b = 0;
+	long seen = 0;
+	for (q = 0; q < 4; q++) {
+		long rank = (long) (quantiles[q] * total);
+		while (b < LATENCY_BUCKETS - 1 && seen + latency[b] <= rank)
+			seen += latency[b++];
+		printf(",%llu", total > 0 ? (unsigned long long) bucket_value(b) : 0ULL);
+	}
+	printf(",%llu", (unsigned long long) max);
+}
+
+/**
+ * Prints the benchmark as CSV, one row per thread and a total row
+ * with the aggregate throughput, the merged latency percentiles,
+ * the parks and futex wakeups of all threads, the payload bytes
+ * consumed per second and the readiness wakeups of consumers with
+ * their latency percentiles
+ *
+ * @param threads	Producer statistics followed by consumer statistics
+ * @param producers	Number of producer threads
+ * @param consumers	Number of consumer threads
+ * @param elapsed_ns	Wall time of the whole run
+ */
+
+void print_benchmark(thread_stats *threads, int producers, int consumers, uint64_t elapsed_ns) {
+	static const char *mode_names[] = { "mutex", "spsc", "mpmc", "sharded", "pipe" };
+	static const char *wait_names[] = { "block", "spin", "yield", "park" };
+	static const char *place_names[] = { "none", "list", "siblings", "socket", "spread" };
+	long merged[LATENCY_BUCKETS] = { 0 };
+	long woken[LATENCY_BUCKETS] = { 0 };
+	long wakes = 0;
+	uint64_t max_wake = 0;
+	long consumed = 0;
+	long parks = 0;
+	long wakeups = 0;
+	long steals = 0;
+	long bytes = 0;
+	long produced = 0;
+	uint64_t max = 0;
+	int i;
+	int b;
+	
+	printf("mode,wait,placement,producers,consumers,role,thread,cpu,node,items,seconds,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,parks,wakeups,steals,bytes,bytes_per_sec,wakes,wake_p50_ns,wake_p90_ns,wake_p99_ns,wake_p999_ns,wake_max_ns\n");
+	for (i = 0; i < producers + consumers; i++) {
+		thread_stats *t = &threads[i];
+		double seconds = (t->end_ns - t->start_ns) / 1e9;
+		printf("%s%s,%s,%s,%d,%d,%s,%d,%d,%d,%ld,%.6f,%.0f", mode_names[mode], shared_name != NULL ? "-shm" : "",
+		       wait_names[strategy], place_names[place], producers, consumers, i < producers ? "producer" : "consumer",
+		       t->id, t->cpu, cpu_node(t->cpu), t->ops, seconds, seconds > 0 ? t->ops / seconds : 0.0);
+		parks += t->parks;
+		wakeups += t->wakeups;
+		if (i < producers) {
+			produced += t->ops;
+			printf(",,,,,,%ld,%ld,,%ld,%.0f,,,,,,\n", t->parks, t->wakeups, t->bytes,
+			       seconds > 0 ? t->bytes / seconds : 0.0);
+			continue;
+		}
+		print_percentiles(t->latency, t->ops, t->max_latency);
+		printf(",%ld,%ld,%ld,%ld,%.0f,%ld", t->parks, t->wakeups, t->steals, t->bytes,
+		       seconds > 0 ? t->bytes / seconds : 0.0, t->wakes);
+		print_percentiles(t->wake_latency, t->wakes, t->max_wake_latency);
+		printf("\n");
+		wakes += t->wakes;
+		for (b = 0; b < LATENCY_BUCKETS; b++)
+			woken[b] += t->wake_latency[b];
+		if (t->max_wake_latency > max_wake)
+			max_wake = t->max_wake_latency;
+		steals += t->steals;
+		bytes += t->bytes;
+		for (b = 0; b < LATENCY_BUCKETS; b++)
+			merged[b] += t->latency[b];
+		consumed += t->ops;
+		if (t->max_latency > max)
+			max = t->max_latency;
+	}
+	//The total row gives the node the buffer's slots were placed on,
+	//and the items produced in a process without consumers
+	long items = consumers > 0 ? consumed : produced;
+	printf("%s%s,%s,%s,%d,%d,total,0,,%d,%ld,%.6f,%.0f", mode_names[mode], shared_name != NULL ? "-shm" : "",
+	       wait_names[strategy], place_names[place], producers, consumers,
+	       address_node(shard_count > 0 ? shards[0]->slots : buffer->slots),
+	       items, elapsed_ns / 1e9, items / (elapsed_ns / 1e9));
+	print_percentiles(merged, consumed, max);
+	printf(",%ld,%ld,%ld,%ld,%.0f,%ld", parks, wakeups, steals, bytes, bytes / (elapsed_ns / 1e9), wakes);
+	print_percentiles(woken, wakes, max_wake);
+	printf("\n");
+}
+
+/**
+ * Prints contention counters as CSV to stderr, so they stay out of
+ * the benchmark's output: the lock acquisitions, contended attempts
+ * and time waited for the mutex, the waits and time spent on a full
+ * and an empty buffer and the occupancy histogram, one column per
+ * 16th of the capacity. The header comes with the first rows.
+ *
+ * @param threads	Producer statistics followed by consumer statistics
+ * @param producers	Number of producer threads
+ * @param consumers	Number of consumer threads
+ * @param elapsed_ns	Time since the threads were started
+ * @param per_thread	Whether to print a row per thread before the total row
+ */
+
+void print_contention(thread_stats *threads, int producers, int consumers, uint64_t elapsed_ns, int per_thread) {
+	static int header;
+	long total[7 + OCCUPANCY_BUCKETS] = { 0 };
+	long row[7 + OCCUPANCY_BUCKETS];
+	int i;
+	int b;
+	
+	if (!header) {
+		fprintf(stderr, "seconds,role,thread,locks,contended,lock_wait_ns,full_waits,full_wait_ns,empty_waits,empty_wait_ns");
+		for (b = 0; b < OCCUPANCY_BUCKETS; b++)
+			fprintf(stderr, ",occupancy_%d", b * 100 / (OCCUPANCY_BUCKETS - 1));
+		fprintf(stderr, "\n");
+		header = 1;
+	}
+	for (i = 0; i < producers + consumers; i++) {
+		contention_stats *c = &threads[i].contention;
+		row[0] = atomic_load_explicit(&c->locks, memory_order_relaxed);
+		row[1] = atomic_load_explicit(&c->contended, memory_order_relaxed);
+		row[2] = atomic_load_explicit(&c->lock_wait_ns, memory_order_relaxed);
+		row[3] = atomic_load_explicit(&c->full_waits, memory_order_relaxed);
+		row[4] = atomic_load_explicit(&c->full_wait_ns, memory_order_relaxed);
+		row[5] = atomic_load_explicit(&c->empty_waits, memory_order_relaxed);
+		row[6] = atomic_load_explicit(&c->empty_wait_ns, memory_order_relaxed);
+		for (b = 0; b < OCCUPANCY_BUCKETS; b++)
+			row[7 + b] = atomic_load_explicit(&c->occupancy[b], memory_order_relaxed);
+		if (per_thread) {
+			fprintf(stderr, "%.3f,%s,%d", elapsed_ns / 1e9, i < producers ? "producer" : "consumer", threads[i].id);
+			for (b = 0; b < 7 + OCCUPANCY_BUCKETS; b++)
+				fprintf(stderr, ",%ld", row[b]);
+			fprintf(stderr, "\n");
+		}
+		for (b = 0; b < 7 + OCCUPANCY_BUCKETS; b++)
+			total[b] += row[b];
+	}
+	fprintf(stderr, "%.3f,total,0", elapsed_ns / 1e9);
+	for (b = 0; b < 7 + OCCUPANCY_BUCKETS; b++)
+		fprintf(stderr, ",%ld", total[b]);
+	fprintf(stderr, "\n");
+}
+
+/**
+ * Prints the counts of every priority lane summed over the threads:
+ * the items inserted, rejected by the full-buffer policy, dropped as
+ * the oldest and removed. The benchmark prints them as CSV after
+ * its own rows and a blank line, with the latency percentiles of
+ * each lane.
+ *
+ * @param threads	Producer statistics followed by consumer statistics
+ * @param producers	Number of producer threads
+ * @param consumers	Number of consumer threads
+ */
+
+void print_lanes(thread_stats *threads, int producers, int consumers) {
+	static const char *policy_names[] = { "block", "fail", "drop", "timeout" };
+	long merged[LATENCY_BUCKETS];
+	int l;
+	int i;
+	int b;
+	
+	if (benchmark)
+		printf("\nlane,order,weight,policy,inserted,rejected,dropped,removed,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+	for (l = 0; l < lane_count; l++) {
+		lane_stats sum = { 0 };
+		memset(merged, 0, sizeof(merged));
+		for (i = 0; i < producers + consumers; i++) {
+			lane_stats *lane = &threads[i].per_lane[l];
+			sum.inserted += lane->inserted;
+			sum.rejected += lane->rejected;
+			sum.dropped += lane->dropped;
+			sum.removed += lane->removed;
+			if (lane->max_latency > sum.max_latency)
+				sum.max_latency = lane->max_latency;
+			for (b = 0; b < LATENCY_BUCKETS && lane->latency != NULL; b++)
+				merged[b] += lane->latency[b];
+		}
+		if (!benchmark) {
+			printf("Lane %d: %ld inserted, %ld rejected, %ld dropped, %ld removed\n", l,
+			       sum.inserted, sum.rejected, sum.dropped, sum.removed);
+			continue;
+		}
+		printf("%d,%s,%d,%s,%ld,%ld,%ld,%ld", l, order == LANES_STRICT ? "strict" : "weighted",
+		       order == LANES_STRICT ? 1 : lane_weights[l], policy_names[policy],
+		       sum.inserted, sum.rejected, sum.dropped, sum.removed);
+		print_percentiles(merged, sum.removed, sum.max_latency);
+		printf("\n");
+	}
+}
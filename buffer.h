@@ -1,13 +1,228 @@
 /**
  * Author: John Lorenz Salva
- * 
+ *
  * buffer.h defines a buffer
  **/
 
 #ifndef BUFFER_H
 #define BUFFER_H
 
-typedef int buffer_item;
-#define BUFFER_SIZE 5
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+#define CACHE_LINE_SIZE 64
+#define DEFAULT_BUFFER_SIZE 8
+#define SLAB_MIN_SHIFT 3
+#define SLAB_MAX_SHIFT 16
+#define SLAB_CLASSES (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define SHARED_MAGIC 0x42554631
+
+/**
+ * Item moved through the buffer. stamp holds the enqueue time
+ * in ns in benchmark mode. With payloads, data points to length
+ * bytes in a slab block the consumer releases, so only the
+ * descriptor is copied through the buffer. lane is the priority
+ * lane the item goes through, 0 the most urgent.
+ **/
+
+typedef struct {
+	int value;
+	uint32_t length;
+	uint64_t stamp;
+	void *data;
+	uint32_t lane;
+} buffer_item;
+
+/**
+ * Size class of the payload slab, blocks of 8 B to 64 KB. Free
+ * blocks form a lock-free stack linked through next, indexed by
+ * block number; head packs a pop counter above the index of the
+ * top block plus one, so a block freed and reused between a
+ * thread's read of head and its CAS cannot be mistaken for the
+ * same top.
+ **/
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_uint_least64_t head;
+	char *base;
+	atomic_uint *next;
+	uint32_t blocks;
+	size_t block_size;
+} slab_class;
+
+
+/**
+ * Bounded buffer implementations selectable at startup. MUTEX is the
+ * mutex and counting semaphore baseline, SPSC a wait-free ring for one
+ * producer and one consumer and MPMC a lock-free ring of
+ * sequence-numbered slots for any number of each. SHARDED gives every
+ * producer its own SPSC ring that consumers drain under a per-ring
+ * consumer lock, stealing from other producers' rings when idle.
+ * PIPE sends the items through a pipe as a kernel-copy baseline.
+ **/
+
+typedef enum {
+	MODE_MUTEX,
+	MODE_SPSC,
+	MODE_MPMC,
+	MODE_SHARDED,
+	MODE_PIPE
+} buffer_mode;
+
+/**
+ * Order in which a sharded consumer visits the rings. HOME drains
+ * its own rings before stealing, ROUND_ROBIN visits every ring in
+ * turn and LONGEST takes the fullest ring first.
+ **/
+
+typedef enum {
+	FAIR_HOME,
+	FAIR_ROUND_ROBIN,
+	FAIR_LONGEST
+} fairness_policy;
+
+/**
+ * Order in which consumers take from the priority lanes. STRICT
+ * always takes the most urgent lane holding items, WEIGHTED takes up
+ * to a lane's weight in items before moving on to the next lane.
+ **/
+
+typedef enum {
+	LANES_STRICT,
+	LANES_WEIGHTED
+} lane_order;
+
+/**
+ * What a producer does when its ring is full. BLOCK waits for room,
+ * FAIL returns at once with the items rejected, DROP_OLDEST removes
+ * the oldest item to make room and TIMEOUT waits for room up to a
+ * deadline before rejecting the items.
+ **/
+
+typedef enum {
+	FULL_BLOCK,
+	FULL_FAIL,
+	FULL_DROP_OLDEST,
+	FULL_TIMEOUT
+} full_policy;
+
+/**
+ * How a thread waits for a full or empty buffer. BLOCK is the mode's
+ * own wait, the semaphores for MUTEX and a yield loop for the rings.
+ * SPIN busy-waits, YIELD spins and then yields the CPU between tries
+ * and PARK spins and then sleeps on the side's futex.
+ **/
+
+typedef enum {
+	WAIT_BLOCK,
+	WAIT_SPIN,
+	WAIT_YIELD,
+	WAIT_PARK
+} wait_strategy;
+
+/**
+ * Where producer and consumer threads run. Producer k and consumer k
+ * form a pair taking the 2k-th and 2k+1-th CPU of an order read from
+ * /sys: SIBLINGS puts a pair on the hardware threads of one core, or
+ * neighbouring cores without SMT, SOCKET on two cores of one package
+ * and SPREAD on two packages. LIST takes the order from the command
+ * line and NONE leaves placement to the kernel.
+ **/
+
+typedef enum {
+	PLACE_NONE,
+	PLACE_LIST,
+	PLACE_SIBLINGS,
+	PLACE_SOCKET,
+	PLACE_SPREAD
+} placement;
+
+/**
+ * Distributions of the delay between a producer's bursts or a
+ * consumer's removals, in microseconds: CONSTANT, UNIFORM between
+ * two bounds, EXPONENTIAL around a mean, and BURSTY, a run of
+ * exponential gaps followed by one long exponential off period.
+ **/
+
+typedef enum {
+	DIST_CONSTANT,
+	DIST_UNIFORM,
+	DIST_EXPONENTIAL,
+	DIST_BURSTY
+} distribution_kind;
+
+/**
+ * Futex a side parks on. seq is bumped before every wake so a waiter
+ * that read it before the buffer changed never sleeps through the
+ * change, and a poster only makes the wake syscall while waiters
+ * is non-zero.
+ **/
+
+typedef struct {
+	atomic_uint seq;
+	atomic_int waiters;
+} wait_event;
+
+/**
+ * Counting semaphore whose permits move in batches. count is the
+ * futex word, so a batch of permits is taken with one compare-and-swap
+ * and given back with one add, and waiters lets a giver skip the wake
+ * syscall while nobody sleeps.
+ **/
+
+typedef struct {
+	atomic_uint count;
+	atomic_int waiters;
+} batch_semaphore;
+
+/**
+ * Slot of the ring. The MPMC ring uses seq to hand the slot between
+ * producers and consumers: it is free for position pos when
+ * seq == pos and holds the item of pos when seq == pos + 1.
+ **/
+
+typedef struct {
+	atomic_size_t seq;
+	buffer_item item;
+} buffer_slot;
+
+/**
+ * Bounded buffer of a runtime power-of-two capacity, allocated
+ * cache-line aligned with its slots behind it. tail is written by
+ * producers and head by consumers, and each sits on its own cache
+ * line next to that side's cached copy of the other index, so the
+ * two sides only share a line when one has to look at the other.
+ * consumer_lock lets several consumers take turns on a sharded ring.
+ * The mutex, semaphores and futexes get a line each as well.
+ *
+ * A buffer shared between processes keeps its bookkeeping on the
+ * last line: magic is set once the creator initialized it, attached
+ * counts the processes mapping it, open_producers the producer
+ * threads still running in any of them, and closed is set when the
+ * last of those finished so consumers everywhere can drain and stop.
+ **/
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+	size_t head_cache;
+	_Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+	size_t tail_cache;
+	atomic_int consumer_lock;
+	_Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+	_Alignas(CACHE_LINE_SIZE) batch_semaphore empty;
+	_Alignas(CACHE_LINE_SIZE) batch_semaphore full;
+	_Alignas(CACHE_LINE_SIZE) wait_event not_full;
+	_Alignas(CACHE_LINE_SIZE) wait_event not_empty;
+	_Alignas(CACHE_LINE_SIZE) size_t capacity;
+	size_t mask;
+	size_t size;
+	atomic_uint magic;
+	atomic_int attached;
+	atomic_int open_producers;
+	atomic_int closed;
+	_Alignas(CACHE_LINE_SIZE) buffer_slot slots[];
+} bounded_buffer;
+
+#endif
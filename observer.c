@@ -10,7 +10,12 @@
 #include <string.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
 #include <time.h>
+#include <unistd.h>
 #define CPU_FILE "/proc/cpuinfo"
 #define DISK_FILE "/proc/diskstats"
 #define HOST_FILE "/proc/sys/kernel/hostname"
@@ -19,9 +24,63 @@
 #define MEM_FILE "/proc/meminfo"
 #define STAT_FILE "/proc/stat"
 #define UPTIME_FILE "/proc/uptime"
-#define BUFFER_LENGTH 200
+#define PROC_BUFFER_LENGTH 65536
+#define BENCH_ITERATIONS 100000
 
-FILE *open_file(char* file);
+/* The /proc files read, each opened once and re-read from offset 0 */
+enum proc_index { CPU, DISK, HOST, KERNEL_VER, LDAVG, MEM, STAT, UPTIME, PROC_FILES };
+
+typedef struct {
+   const char *path;
+   int fd;
+} proc_file;
+
+static proc_file proc_files[PROC_FILES] = {
+   { CPU_FILE, -1 }, { DISK_FILE, -1 }, { HOST_FILE, -1 }, { KERNEL_VER_FILE, -1 },
+   { LDAVG_FILE, -1 }, { MEM_FILE, -1 }, { STAT_FILE, -1 }, { UPTIME_FILE, -1 }
+};
+static char *proc_buffer;
+static size_t proc_buffer_length;
+
+/* Counters parsed out of /proc/stat, in USER_HZ ticks where timed */
+typedef struct {
+   uint64_t user;          //User-time, including low priority processes
+   uint64_t system;
+   uint64_t idle;
+   uint64_t ctxt;
+   uint64_t btime;
+   uint64_t processes;
+} stat_sample;
+
+/* Reads and writes completed on the sda, sdb and sdc disks */
+typedef struct {
+   uint64_t reads;
+   uint64_t writes;
+} disk_sample;
+
+/* Memory configured and free, in kB */
+typedef struct {
+   uint64_t total;
+   uint64_t free;
+} mem_sample;
+
+/* Load averages over 1, 5 and 15 minutes, in hundredths */
+typedef struct {
+   uint64_t load1;
+   uint64_t load5;
+   uint64_t load15;
+} ldavg_sample;
+
+char *read_proc(enum proc_index file);
+char *next_line(char **cursor);
+uint64_t parse_u64(const char **cursor);
+uint64_t parse_hundredths(const char **cursor);
+const char *skip_line(const char *p);
+void parse_stat(const char *p, stat_sample *sample);
+void parse_disk(const char *p, disk_sample *sample);
+void parse_mem(const char *p, mem_sample *sample);
+void parse_ldavg(const char *p, ldavg_sample *sample);
+void bench_parse(long iterations);
 void get_host_info(void);
 void get_CPU_info(void);
 void get_kernel_ver_info(void);
@@ -29,34 +88,47 @@ void get_uptime_info(void);
 void get_stat_info(void);
 void get_disk_info(void);
 void get_mem_info(void);
-void get_ldavg_info(int interval, int duration);
+void get_ldavg_info(double interval, double duration);
 
 int main(int argc, char *argv[]) {
    char c1;
    char c2;
    char rep_type_name[16];
-   int duration;
-   int interval;
+   double duration;
+   double interval;
    struct timeval now;
    
    strcpy(rep_type_name, "Standard");
    if (argc > 1) {
       sscanf(argv[1], "%c%c", &c1, &c2);
       if (c1 != '-') {
-         fprintf(stderr, "usage: observer [-s] [-l int dur]\n");
+         fprintf(stderr, "usage: observer [-s] [-l int dur] [-b [iterations]]\n");
          exit(EXIT_FAILURE);
       }
+      if (c2 == 'b') {
+         long iterations = (argc > 2) ? atol(argv[2]) : BENCH_ITERATIONS;
+         if (iterations <= 0) {
+            fprintf(stderr, "usage: observer [-s] [-l int dur] [-b [iterations]]\n");
+            exit(EXIT_FAILURE);
+         }
+         bench_parse(iterations);
+         return EXIT_SUCCESS;
+      }
       if (c2 == 's') {
          strcpy(rep_type_name, "Short");
       }
       if (c2 == 'l') {
 		 if(argc != 4) {
-		    fprintf(stderr, "usage: observer [-s] [-l int dur]\n");
+		    fprintf(stderr, "usage: observer [-s] [-l int dur] [-b [iterations]]\n");
 		    exit(EXIT_FAILURE);
 		 }
          strcpy(rep_type_name, "Long");
-         interval = atoi(argv[2]);
-         duration = atoi(argv[3]);
+         interval = atof(argv[2]);
+         duration = atof(argv[3]);
+         if (interval <= 0) {
+            fprintf(stderr, "usage: observer [-s] [-l int dur] [-b [iterations]]\n");
+            exit(EXIT_FAILURE);
+         }
       }
    }
    
@@ -78,78 +150,324 @@ int main(int argc, char *argv[]) {
    return EXIT_SUCCESS;      
 }
 
-/* Opens the passed file name and error checks */
-FILE *open_file(char* file) {
-   FILE *ptr_file = fopen(file, "r");
-   if (ptr_file == NULL) {
-      printf("Error on fopen %s \n", file);
-      exit(EXIT_FAILURE);
+/* Reads a /proc file whole into proc_buffer, which holds it until
+ * the next read. The file is opened on its first read and kept
+ * open, and every read starts at offset 0 with pread, so a sample
+ * costs no open, close or seek and always sees fresh data. A file
+ * that fills the buffer may go on past it, so the buffer is doubled
+ * and the file read again from the start; it never shrinks, so a
+ * large /proc/stat costs one regrowth, not one per sample.
+ */
+char *read_proc(enum proc_index file) {
+   proc_file *f = &proc_files[file];
+   size_t length;
+   ssize_t got;
+   if (f->fd < 0) {
+      f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+      if (f->fd < 0) {
+         printf("Error on open %s \n", f->path);
+         exit(EXIT_FAILURE);
+      }
+   }
+   if (proc_buffer == NULL) {
+      proc_buffer_length = PROC_BUFFER_LENGTH;
+      proc_buffer = malloc(proc_buffer_length);
+      if (proc_buffer == NULL) {
+         printf("Error on malloc for %s \n", f->path);
+         exit(EXIT_FAILURE);
+      }
+   }
+   while (1) {
+      length = 0;
+      while (length < proc_buffer_length - 1) {
+         got = pread(f->fd, proc_buffer + length, proc_buffer_length - 1 - length, length);
+         if (got < 0 && errno == EINTR) {
+            continue;
+         }
+         if (got < 0) {
+            printf("Error on pread %s \n", f->path);
+            exit(EXIT_FAILURE);
+         }
+         if (got == 0) {
+            break;
+         }
+         length += got;
+      }
+      if (length < proc_buffer_length - 1) {
+         break;
+      }
+      char *grown = realloc(proc_buffer, proc_buffer_length * 2);
+      if (grown == NULL) {
+         printf("Error on realloc, %s is longer than %zu bytes \n", f->path, proc_buffer_length - 1);
+         exit(EXIT_FAILURE);
+      }
+      proc_buffer = grown;
+      proc_buffer_length *= 2;
+   }
+   proc_buffer[length] = '\0';
+   return proc_buffer;
+}
+
+/* Returns the line at the cursor with its newline cut off and moves
+ * the cursor to the next line, or returns NULL at the end */
+char *next_line(char **cursor) {
+   char *line = *cursor;
+   char *end;
+   if (*line == '\0') {
+      return NULL;
+   }
+   end = strchr(line, '\n');
+   if (end == NULL) {
+      *cursor = line + strlen(line);
+   } else {
+      *end = '\0';
+      *cursor = end + 1;
+   }
+   return line;
+}
+
+/* Returns the unsigned decimal at the cursor, after any blanks, and
+ * moves the cursor past it. Anything that is not a digit ends the
+ * number, so a missing field reads as 0 */
+uint64_t parse_u64(const char **cursor) {
+   const char *p = *cursor;
+   uint64_t value = 0;
+   while (*p == ' ' || *p == '\t') {
+      p++;
+   }
+   while (*p >= '0' && *p <= '9') {
+      value = value * 10 + (uint64_t) (*p - '0');
+      p++;
+   }
+   *cursor = p;
+   return value;
+}
+
+/* Returns a decimal such as 0.60 at the cursor in hundredths, dropping
+ * any further digits, and moves the cursor past it */
+uint64_t parse_hundredths(const char **cursor) {
+   uint64_t value = parse_u64(cursor) * 100;
+   const char *p = *cursor;
+   if (*p == '.') {
+      p++;
+      if (*p >= '0' && *p <= '9') {
+         value += (uint64_t) (*p++ - '0') * 10;
+         if (*p >= '0' && *p <= '9') {
+            value += (uint64_t) (*p++ - '0');
+         }
+      }
+      while (*p >= '0' && *p <= '9') {
+         p++;
+      }
+   }
+   *cursor = p;
+   return value;
+}
+
+/* Returns the start of the line after the one at p, or the end of
+ * the text */
+const char *skip_line(const char *p) {
+   const char *end = strchr(p, '\n');
+   return (end == NULL) ? p + strlen(p) : end + 1;
+}
+
+/* Parses /proc/stat in one pass. Lines are told apart by their name
+ * and the values read in place, so the per-cpu and interrupt lines
+ * cost no more than the search for their end */
+void parse_stat(const char *p, stat_sample *sample) {
+   memset(sample, 0, sizeof *sample);
+   while (*p != '\0') {
+      if (strncmp(p, "cpu ", 4) == 0) {
+         p += 4;
+         sample->user = parse_u64(&p);
+         sample->user += parse_u64(&p);
+         sample->system = parse_u64(&p);
+         sample->idle = parse_u64(&p);
+      } else if (strncmp(p, "ctxt ", 5) == 0) {
+         p += 5;
+         sample->ctxt = parse_u64(&p);
+      } else if (strncmp(p, "btime ", 6) == 0) {
+         p += 6;
+         sample->btime = parse_u64(&p);
+      } else if (strncmp(p, "processes ", 10) == 0) {
+         p += 10;
+         sample->processes = parse_u64(&p);
+      }
+      p = skip_line(p);
+   }
+}
+
+/* Parses /proc/diskstats in one pass, summing the reads and writes
+ * completed on the sda, sdb and sdc disks. The name is matched where
+ * it lies between the device numbers and the counters */
+void parse_disk(const char *p, disk_sample *sample) {
+   memset(sample, 0, sizeof *sample);
+   while (*p != '\0') {
+      parse_u64(&p);         //Major number
+      parse_u64(&p);         //Minor number
+      while (*p == ' ' || *p == '\t') {
+         p++;
+      }
+      if (p[0] == 's' && p[1] == 'd' && p[2] >= 'a' && p[2] <= 'c' && (p[3] == ' ' || p[3] == '\t')) {
+         p += 3;
+         sample->reads += parse_u64(&p);
+         parse_u64(&p);      //Reads merged
+         parse_u64(&p);      //Sectors read
+         parse_u64(&p);      //Time spent reading
+         sample->writes += parse_u64(&p);
+      }
+      p = skip_line(p);
+   }
+}
+
+/* Parses /proc/meminfo, stopping once both fields are found since
+ * they lead the file */
+void parse_mem(const char *p, mem_sample *sample) {
+   int found = 0;
+   memset(sample, 0, sizeof *sample);
+   while (*p != '\0' && found < 2) {
+      if (strncmp(p, "MemTotal:", 9) == 0) {
+         p += 9;
+         sample->total = parse_u64(&p);
+         found++;
+      } else if (strncmp(p, "MemFree:", 8) == 0) {
+         p += 8;
+         sample->free = parse_u64(&p);
+         found++;
+      }
+      p = skip_line(p);
+   }
+}
+
+/* Parses the three load averages that lead /proc/loadavg */
+void parse_ldavg(const char *p, ldavg_sample *sample) {
+   sample->load1 = parse_hundredths(&p);
+   sample->load5 = parse_hundredths(&p);
+   sample->load15 = parse_hundredths(&p);
+}
+
+/* Times the parsers against a snapshot of each file, and a full
+ * sample of pread and parse, printing the cost per sample in ns */
+void bench_parse(long iterations) {
+   static const enum proc_index files[] = { STAT, DISK, MEM, LDAVG };
+   stat_sample stat;
+   disk_sample disk;
+   mem_sample mem;
+   ldavg_sample ldavg;
+   volatile uint64_t sink = 0;
+   double total_parse = 0;
+   double total_sample = 0;
+   size_t f;
+   printf("Parse cost per sample over %ld iterations\n", iterations);
+   printf("--------------------------------------------------\n\n");
+   printf("%-16s %8s %12s %14s\n", "file", "bytes", "parse ns", "pread+parse ns");
+   for (f = 0; f < sizeof files / sizeof files[0]; f++) {
+      struct timespec start;
+      struct timespec end;
+      double parse_ns;
+      double sample_ns;
+      size_t bytes;
+      long i;
+      int pass;
+      char *snapshot = strdup(read_proc(files[f]));
+      if (snapshot == NULL) {
+         printf("Error on strdup for %s \n", proc_files[files[f]].path);
+         exit(EXIT_FAILURE);
+      }
+      bytes = strlen(snapshot);
+      
+      //The first pass parses the snapshot alone, the second reads it too
+      for (pass = 0; pass < 2; pass++) {
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         for (i = 0; i < iterations; i++) {
+            const char *data = (pass == 0) ? snapshot : read_proc(files[f]);
+            switch (files[f]) {
+            case STAT:
+               parse_stat(data, &stat);
+               sink += stat.ctxt;
+               break;
+            case DISK:
+               parse_disk(data, &disk);
+               sink += disk.reads;
+               break;
+            case MEM:
+               parse_mem(data, &mem);
+               sink += mem.free;
+               break;
+            default:
+               parse_ldavg(data, &ldavg);
+               sink += ldavg.load1;
+               break;
+            }
+         }
+         clock_gettime(CLOCK_MONOTONIC, &end);
+         sample_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+         if (pass == 0) {
+            parse_ns = sample_ns;
+         }
+      }
+      free(snapshot);
+      total_parse += parse_ns;
+      total_sample += sample_ns;
+      printf("%-16s %8zu %12.1f %14.1f\n", proc_files[files[f]].path, bytes, parse_ns, sample_ns);
    }
-   return ptr_file;
+   printf("%-16s %8s %12.1f %14.1f\n", "total", "", total_parse, total_sample);
+   (void) sink;
 }
 
 /* Gets the kernel host name from /proc/svs/kernel/hostname */
 void get_host_info(void) {
-   char data[BUFFER_LENGTH];
-   FILE *ptr_file = open_file(HOST_FILE);
-   fgets(data, sizeof data, ptr_file);
+   char *data = read_proc(HOST);
    printf("Machine hostname: %s", data);
    fflush(stdout);
-   fclose(ptr_file);
 }
 
 /* Gets the name of the CPU on the machine from /proc/cpuinfo */
 void get_CPU_info(void) {
-   char data[BUFFER_LENGTH];
+   char *cursor = read_proc(CPU);
+   char *data;
    char *token_ptr;
-   FILE *ptr_file = open_file(CPU_FILE);
    int count = 0;
-   while(fgets(data, sizeof data, ptr_file)) {
+   while((data = next_line(&cursor)) != NULL) {
       if (strncmp(data, "model name", 10) == 0) {
          break;
       }
    }
+   if (data == NULL) {
+      return;
+   }
    
    //tokenize the string and break when we get the name
    token_ptr = strtok(data, ":");
    while (token_ptr != NULL) {
 	   if (count == 1) {
-		   strncpy(data, token_ptr, BUFFER_LENGTH - 1);
+		   data = token_ptr;
 		   break;
 	   }
 	   token_ptr = strtok(NULL, ":");
 	   count++;
    }
-   printf("CPU Model: %s", data);
+   printf("CPU Model: %s\n", data);
    fflush(stdout);
-   fclose(ptr_file);
 }
 
 /* Gets the kernal version info from /proc/version */
 void get_kernel_ver_info(void) {
-   char data[BUFFER_LENGTH];
-   FILE *ptr_file = open_file(KERNEL_VER_FILE);
-   fgets(data, sizeof data, ptr_file);
+   char *data = read_proc(KERNEL_VER);
    printf("%s", data);
    fflush(stdout);
-   fclose(ptr_file); 
 }
 
 /* Gets the amount time the system has been up
  * since the last system boot. Info is retreived
  * from /proc/uptime */
 void get_uptime_info(void) {
-   char data[BUFFER_LENGTH];
-   double uptime;
-   FILE *ptr_file = open_file(UPTIME_FILE);
+   double uptime = atof(read_proc(UPTIME));
    int days;
    int hours;
    int minutes;
    int seconds;
    int remainder;
-   fscanf(ptr_file, "%s", data);
-   fclose(ptr_file);
-   uptime = atof(data);
    days = (uptime / (24 * 3600));
    remainder = ((int) uptime % (24 * 3600));
    hours = remainder / 3600;
@@ -169,83 +487,28 @@ void get_uptime_info(void) {
  * system was last booted. Info retrieved from /proc/stat.
  */
 void get_stat_info(void) {
-   char data[BUFFER_LENGTH];
-   FILE *ptr_file = open_file(STAT_FILE);
-   int cpu_user_time = 0;
-   int cpu_sys_time = 0;
-   int cpu_idle_time = 0;
-   int ctxt = 0;
-   int processes = 0;
+   stat_sample sample;
    time_t btime;
-   while(fgets(data, sizeof data, ptr_file) != NULL) {
-      if(strncmp(data, "cpu ", 4) == 0) {
-         char cpu_name_data[BUFFER_LENGTH];	//CPU name
-         char ut1_data[BUFFER_LENGTH];		//User-time spent
-         char ut2_data[BUFFER_LENGTH];		//User-time spent with low priority processes
-         char st_data[BUFFER_LENGTH];		//System-time spent
-         char it_data[BUFFER_LENGTH];		//Idle-time spent
-         int ut1;
-         int ut2;
-         int st;
-         int it;
-         sscanf(data, "%s%s%s%s%s", cpu_name_data, ut1_data, ut2_data, st_data, it_data);
-         ut1 = atoi(ut1_data);
-         ut2 = atoi(ut2_data);
-         st = atoi(st_data);
-         it = atoi(it_data);
-         cpu_user_time = (ut1 + ut2);
-         cpu_sys_time = st;
-         cpu_idle_time = it;
-      } else if (strncmp(data, "ctxt", 4) == 0) {
-         char ctxt_name_data[BUFFER_LENGTH];
-         char ctxt_data[BUFFER_LENGTH];
-         sscanf(data, "%s%s", ctxt_name_data, ctxt_data);
-         ctxt = atoi(ctxt_data);
-      } else if(strncmp(data, "btime", 5) == 0) {
-         char btime_name_data[BUFFER_LENGTH];
-         char btime_data[BUFFER_LENGTH];
-         sscanf(data, "%s%s", btime_name_data, btime_data);
-         btime = atoi(btime_data);
-      } else if(strncmp(data, "process", 7) == 0) {
-         char p_name_data[BUFFER_LENGTH];
-         char p_data[BUFFER_LENGTH];
-         sscanf(data, "%s%s", p_name_data, p_data);
-         processes = atoi(p_data);
-      }
-   }
-   fclose(ptr_file);
+   parse_stat(read_proc(STAT), &sample);
+   btime = (time_t) sample.btime;
    
-   printf("Time that all CPUs spent in user mode is: %d USER_HZ\n", cpu_user_time);
-   printf("Time that all CPUs spent in system mode is: %d USER_HZ\n", cpu_sys_time);
-   printf("Time that all CPUs spent in idle mode is: %d USER_HZ\n", cpu_idle_time);
-   printf("Number of context switches the kernel has performed: %d\n", ctxt);
+   printf("Time that all CPUs spent in user mode is: %" PRIu64 " USER_HZ\n", sample.user);
+   printf("Time that all CPUs spent in system mode is: %" PRIu64 " USER_HZ\n", sample.system);
+   printf("Time that all CPUs spent in idle mode is: %" PRIu64 " USER_HZ\n", sample.idle);
+   printf("Number of context switches the kernel has performed: %" PRIu64 "\n", sample.ctxt);
    printf("Time when the system last booted: %s", ctime(&btime));
-   printf("Number of processes created since the system was booted: %d\n", processes);
+   printf("Number of processes created since the system was booted: %" PRIu64 "\n", sample.processes);
 }
 
 /* Gets the amount of reads and writes made to the disk
  * from /proc/diskstats
  */
 void get_disk_info(void) {
-   char data[BUFFER_LENGTH];
-   FILE *ptr_file = open_file(DISK_FILE);
-   int read = 0;
-   int write = 0;
-   while(fgets(data, sizeof data, ptr_file) != NULL) {
-      char skip[BUFFER_LENGTH];
-      char name[BUFFER_LENGTH];
-      char rd[BUFFER_LENGTH];
-      char wr[BUFFER_LENGTH];
-      sscanf(data, "%s%s%s%s%s%s%s%s", skip, skip, name, rd, skip, skip, skip, wr);
-      if ((strcmp(name, "sda") == 0) || (strcmp(name, "sdb") == 0) || (strcmp(name, "sdc") == 0)) {
-         read += atoi(rd);
-         write += atoi(wr);
-      }
-   }
-   fclose(ptr_file);
+   disk_sample sample;
+   parse_disk(read_proc(DISK), &sample);
    
-   printf("Number of disk reads: %d\n", read);
-   printf("Number of disk writes: %d\n\n", write);
+   printf("Number of disk reads: %" PRIu64 "\n", sample.reads);
+   printf("Number of disk writes: %" PRIu64 "\n\n", sample.writes);
 }
 
 /* Gets the amount of memory the system has configured (in kB) and
@@ -253,50 +516,39 @@ void get_disk_info(void) {
  * from /proc/meminfo
  */
 void get_mem_info(void) {
-   char data[BUFFER_LENGTH];
-   FILE *ptr_file = open_file(MEM_FILE);
-   int kb_ram_total;
-   int kb_ram_free;
-   while(fgets(data, sizeof data, ptr_file) != NULL) {
-      char name[BUFFER_LENGTH];
-      char mem_data[BUFFER_LENGTH];
-      sscanf(data, "%s%s", name, mem_data);
-      if(strncmp(name, "MemTotal", 8) == 0) {
-         kb_ram_total = atoi(mem_data);
-      } else if (strncmp(name, "MemFree", 7) == 0) {
-         kb_ram_free = atoi(mem_data);
-      }
-   }
-   fclose(ptr_file);
+   mem_sample sample;
+   parse_mem(read_proc(MEM), &sample);
    
-   printf("Amount of Memory on the machine: %d kB\n", kb_ram_total);
-   printf("Amount of Free Memory on the machine: %d kB\n", kb_ram_free); 
+   printf("Amount of Memory on the machine: %" PRIu64 " kB\n", sample.total);
+   printf("Amount of Free Memory on the machine: %" PRIu64 " kB\n", sample.free); 
 }
 
 /* Creates a list of averaged load averages that is sampled 
  * over a minute. Averages are computed every user-given
  * interval over a user-given duration. Info retrieved from
- * /proc/loadavg
+ * /proc/loadavg, re-read for every sample. Samples are taken on
+ * absolute deadlines a whole interval apart, so the time spent
+ * reading and printing never adds up to drift, and intervals can
+ * be fractions of a second.
  */
-void get_ldavg_info(int interval, int duration) {
-   char data[BUFFER_LENGTH];
-   double total = 0;
-   FILE *ptr_file = open_file(LDAVG_FILE);
-   int i = 1;
-   int iteration = 0;
-   printf("Listing Averages of Load Averages every %ds interval up to %ds\n", interval, duration);
+void get_ldavg_info(double interval, double duration) {
+   ldavg_sample sample;
+   uint64_t total = 0;
+   long step = (long) (interval * 1e9);
+   long samples = (long) (duration / interval + 0.999999);
+   long i;
+   struct timespec deadline;
+   printf("Listing Averages of Load Averages every %gs interval up to %gs\n", interval, duration);
    printf("--------------------------------------------------\n\n");
    
-   while (iteration < duration) {
-      sleep(interval);
-      char ld1_data[BUFFER_LENGTH];
-	   double ld1;
-      fgets(data, sizeof data, ptr_file);
-      sscanf(data, "%s", ld1_data);
-	   ld1 = atof(ld1_data);
-	   total = (total + ld1) / i;
-      printf("Avg. of %d load avg(s): %.2lf\n", i,  total);
-	   i++;
-      iteration += interval;
+   clock_gettime(CLOCK_MONOTONIC, &deadline);
+   for (i = 1; i <= samples; i++) {
+      deadline.tv_sec += (deadline.tv_nsec + step) / 1000000000;
+      deadline.tv_nsec = (deadline.tv_nsec + step) % 1000000000;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+         ;
+      parse_ldavg(read_proc(LDAVG), &sample);
+      total += sample.load1;
+      printf("Avg. of %ld load avg(s): %.2lf\n", i, total / (100.0 * i));
    }
 }
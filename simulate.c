@@ -2,13 +2,55 @@
  *
  * simulate.c simulates FIFO, LRU, and OPT
  * page replacement algorithms.
- * 
+ *
  * Date: Spring 2020
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNEL
+#endif
 #define BUFFER_LENGTH 50
+#define NO_FUTURE_USE 10000000
+#define TRACE_MAGIC "PGT1"
+#define TRACE_VERSION 1
+#define TRACE_BLOCK_REFS 4096
+#define MAX_VARINT_BYTES 5
+#define EVENT_BUFFER_LENGTH (1 << 20)
+#define STREAM_CHUNK_LENGTH (1 << 16)
+#define DEFAULT_WINDOW 4096
+#define LINE_LENGTH 256
+#define MAX_HUGE_REGIONS 16
+#define PAGE_SHIFT_4K 12
+#define PAGE_SHIFT_2M 21
+#define PAGE_SHIFT_1G 30
+#define TLB_LANES 4
+#define DEFAULT_FAULT_WINDOW 1000
+#define DEFAULT_TAU 1000
+#define SCALAR_SEARCH_FRAMES 8
+#define WIDE_SEARCH_FRAMES 16
+#define BENCH_MAX_FRAMES 4096
+#define BENCH_LOOKUPS (1 << 26)
+#define USAGE "\nUsage: simulate [-q] [-e <event_file>] <input_file> FIFO|LRU|OPT|WS|WSCLOCK\n" \
+              "       simulate -s -f <frames> [-w <window>] [-q] [-e <event_file>] <input_file>|- FIFO|LRU|OPT|WS|WSCLOCK\n" \
+              "       simulate -a -f <frames> [-p 4K|2M|1G] [-H <start>-<end>[:2M|1G]] [-d] [options] <input_file>|- FIFO|LRU|OPT|WS|WSCLOCK\n" \
+              "       simulate -m global|local|pff -f <frames> [-P <frames>] [-W <refs>] [-F <lower>,<upper>] [options] <input_file>|- FIFO|LRU\n" \
+              "       options: -t <entries>:<ways> [-L <tlb>,<walk>,<memory>,<swap>] [-T <tau>] [-W <refs>]\n" \
+              "       simulate -c <text_trace> <binary_trace>\n" \
+              "       simulate -b\n\n"
 
 typedef struct Node {
    int page;
@@ -20,63 +62,492 @@ typedef struct List {
 	int size;
 } List;
 
+/**
+ * Header of a binary trace file. It is followed by blocks of
+ * at most block_refs references, each made of a block header
+ * (reference count, encoded byte length) and the zigzag delta
+ * of every page against the previous one as a varint. Each block
+ * restarts its delta at 0 so blocks decode independently.
+ **/
+
+typedef struct TraceHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t num_of_pages;
+	uint32_t num_of_frames;
+	uint64_t num_of_requests;
+	uint32_t block_refs;
+	uint32_t num_of_blocks;
+} TraceHeader;
+
+typedef struct BlockHeader {
+	uint32_t count;
+	uint32_t length;
+} BlockHeader;
+
+enum { TRACE_LIST, TRACE_BINARY, TRACE_STREAM };
+enum { EVENT_HIT, EVENT_LOAD };
+enum { POOL_GLOBAL, POOL_LOCAL, POOL_PFF };
+
+/**
+ * Translates virtual addresses into pages. Addresses inside a huge
+ * page region are mapped with that region's page size, all others
+ * with page_shift. Every distinct page gets a dense page number in
+ * order of first touch, kept in an open-addressing table so memory
+ * grows with the pages touched, not with the trace.
+ **/
+
+typedef struct AddressMap {
+	int page_shift;
+	int num_of_regions;
+	uint64_t region_start[MAX_HUGE_REGIONS];
+	uint64_t region_end[MAX_HUGE_REGIONS];
+	int region_shift[MAX_HUGE_REGIONS];
+	int dedupe;
+	int last_page;
+	long addresses;
+	long duplicates;
+	long pages_by_shift[3];
+	uint64_t *keys;
+	int *pages;
+	size_t capacity;
+	size_t count;
+} AddressMap;
+
+/**
+ * Read cursor over a page reference string. List traces walk the
+ * nodes built by init(), binary traces decode the mmap'd blocks in
+ * place. A copy of the cursor can be advanced without disturbing
+ * the original, which is how OPT looks into the future.
+ *
+ * Stream traces read headerless page numbers from a file descriptor
+ * in large chunks and keep the next window_size pages in a ring, so
+ * memory stays constant however long the stream runs. OPT only sees
+ * as far as that window. When an address map is attached the stream
+ * holds address trace lines instead of page numbers.
+ **/
+
+typedef struct Trace {
+	int kind;
+	Node *node;
+	const unsigned char *pos;
+	const unsigned char *end;
+	const unsigned char *block_end;
+	uint32_t left;
+	int prev;
+	int fd;
+	int eof;
+	char *chunk;
+	size_t chunk_pos;
+	size_t chunk_length;
+	int *window;
+	int window_size;
+	int window_head;
+	int window_count;
+	AddressMap *map;
+} Trace;
+
+/**
+ * Record of one reference in the event stream. Every reference
+ * writes exactly one event, so the index of a record is also the
+ * virtual time of the reference. evicted is -1 unless a page was
+ * unloaded to make room.
+ **/
+
+typedef struct Event {
+	uint8_t type;
+	uint8_t pad[3];
+	int32_t page;
+	int32_t frame;
+	int32_t evicted;
+} Event;
+
+/**
+ * Set-associative TLB in front of the frames. Each set keeps its
+ * tags contiguous and padded to a multiple of TLB_LANES with -1, so
+ * a set is searched a vector at a time. Ways are replaced LRU.
+ **/
+
+typedef struct Tlb {
+	int sets;
+	int ways;
+	int stride;
+	int *tags;
+	long *stamps;
+	long clock;
+	long hits;
+	long misses;
+} Tlb;
+
+/**
+ * Latencies of each level of the memory hierarchy, in ns
+ **/
+
+typedef struct Latency {
+	double tlb;
+	double walk;
+	double memory;
+	double swap;
+} Latency;
+
+/**
+ * Counters of a simulation run. In quiet mode nothing is printed
+ * per reference; events still go to the event file when one is open.
+ **/
+
+typedef struct Stats {
+	int quiet;
+	int size;
+	long references;
+	long page_faults;
+	long *evictions;
+	int event_fd;
+	unsigned char *events;
+	size_t event_length;
+	Tlb *tlb;
+	Latency latency;
+} Stats;
+
+/**
+ * Frame of the shared pool. Resident frames sit on the pool-wide
+ * list and on their process's list, both kept in load order for FIFO
+ * and in use order for LRU, so the victim is always a list head.
+ * Free frames are chained through gnext. process is the index of the
+ * owner in the pool's process table.
+ **/
+
+typedef struct PoolFrame {
+	int process;
+	int page;
+	int gprev;
+	int gnext;
+	int pprev;
+	int pnext;
+} PoolFrame;
+
+/**
+ * Per-process state. allocation is the partition size for local
+ * replacement and the frames granted so far for page-fault-frequency.
+ * The window counters cover the current window of the process's own
+ * references.
+ **/
+
+typedef struct Process {
+	int pid;
+	int resident;
+	int peak;
+	int allocation;
+	int head;
+	int tail;
+	long references;
+	long page_faults;
+	long window_references;
+	long window_faults;
+	long windows;
+	long thrashing_windows;
+} Process;
+
+/**
+ * Frame pool shared by every process of a multi-process trace.
+ * Resident (process, page) pairs are found through an open-addressing
+ * table sized for the frames, so every reference costs O(1) whatever
+ * the number of processes. Processes are numbered densely in order of
+ * first reference, and a second open-addressing table maps each pid to
+ * its number, so memory grows with the processes seen, not with the
+ * largest pid.
+ **/
+
+typedef struct Pool {
+	int policy;
+	int lru;
+	int size;
+	PoolFrame *frames;
+	int free_head;
+	int head;
+	int tail;
+	Process *processes;
+	int num_of_processes;
+	int process_capacity;
+	uint64_t *pid_keys;
+	int *pid_indices;
+	size_t pid_capacity;
+	uint64_t *keys;
+	int *slots;
+	size_t capacity;
+	int partition;
+	long window;
+	double lower;
+	double upper;
+	long allocated;
+} Pool;
+
 FILE *open_file(char *file);
 void add_to_list(List *pages, int page);
 void init(List *pages, FILE *input, int page_num, int num_of_requests);
 void init_array(int frame[], int size);
-void FIFO(int frame[], int size, List *requests);
-void LRU(int frame[], int size, List *requests);
-void OPT(int frame[], int size, List *requests);
-int find_opt_replace_index(int page, Node *current);
-int find_LRU_replace_index(int page, Node *current, List* requests);
+void init_list_trace(Trace *trace, List *pages);
+void open_binary_trace(Trace *trace, char *file, TraceHeader *header);
+void check_binary_trace(Trace *trace, TraceHeader *header, char *file);
+void open_stream_trace(Trace *trace, char *file, int window_size);
+void convert_trace(char *text_file, char *binary_file);
+int parse_page_size(char *size);
+void init_address_map(AddressMap *map, int page_shift, int dedupe);
+void add_huge_region(AddressMap *map, char *region);
+int map_address(AddressMap *map, uint64_t address);
+void print_address_stats(AddressMap *map);
+int trace_next(Trace *trace, int *page);
+int trace_next_process(Trace *trace, int *pid, int *page);
+int find_frame(int frame[], int size, int page);
+void init_find_frame(void);
+void benchmark_find_frame(void);
+void init_stats(Stats *stats, int size, int quiet, char *event_file);
+void record_hit(Stats *stats, int page, int frame);
+void record_load(Stats *stats, int page, int frame, int evicted);
+void record_unload(Stats *stats, int page, int frame);
+void record_window(Stats *stats, long window, int working_set, long *window_faults);
+void flush_events(Stats *stats);
+void print_stats(Stats *stats);
+void init_tlb(Tlb *tlb, char *geometry);
+void parse_latency(Latency *latency, char *latencies);
+void tlb_access(Tlb *tlb, int page);
+void tlb_invalidate(Tlb *tlb, int page);
+void init_pool(Pool *pool, int size, char *policy, int partition, long window, char *thresholds);
+void simulate_processes(Pool *pool, Trace *requests, Stats *stats);
+void print_pool_stats(Pool *pool);
+void FIFO(int frame[], int size, Trace *requests, Stats *stats);
+void LRU(int frame[], int size, Trace *requests, Stats *stats);
+void WS(int frame[], int size, Trace *requests, Stats *stats, long tau, long window);
+void WSCLOCK(int frame[], int size, Trace *requests, Stats *stats, long tau, long window);
+void OPT(int frame[], int size, Trace *requests, Stats *stats);
+int find_opt_replace_index(int page, Trace *current);
+int find_LRU_replace_index(long last_use[], int size);
 
 /**
  * Main function
  */
 
 int main(int argc, char *argv[]) {
-	
-	List *requests = (List*) malloc(sizeof(List));
+
+	List *requests = (List*) calloc(1, sizeof(List));
+	Trace trace;
+	TraceHeader header;
+	Stats stats;
 	char page_num_data[BUFFER_LENGTH];
    char frame_data[BUFFER_LENGTH];
    char request_data[BUFFER_LENGTH];
 	char data[BUFFER_LENGTH];
+	char *event_file = NULL;
+	char *regions[MAX_HUGE_REGIONS];
+	AddressMap map;
+	Tlb tlb;
+	Pool pool;
+	Latency latency = { 1, 30, 100, 5000000 };
+	char *pool_policy = NULL;
+	char *pff_thresholds = "0.02,0.10";
 	FILE *input;
-	
-	if (argc <= 2) {
-		printf("\nUsage: simulate <input_file> FIFO|LRU|OPT\n\n");
+	int frame_size = 0;
+	int partition = 0;
+	long fault_window = DEFAULT_FAULT_WINDOW;
+	long tau = DEFAULT_TAU;
+	int window_size = DEFAULT_WINDOW;
+	int num_of_regions = 0;
+	int page_shift = PAGE_SHIFT_4K;
+	int addresses = 0;
+	int dedupe = 0;
+	int convert = 0;
+	int benchmark = 0;
+	int stream = 0;
+	int quiet = 0;
+	int use_tlb = 0;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "abcde:f:F:H:L:m:p:P:qst:T:w:W:")) != -1) {
+		switch (opt) {
+		case 'a':
+			addresses = 1;
+			stream = 1;
+			break;
+		case 'b':
+			benchmark = 1;
+			break;
+		case 'c':
+			convert = 1;
+			break;
+		case 'd':
+			dedupe = 1;
+			break;
+		case 'e':
+			event_file = optarg;
+			break;
+		case 'f':
+			frame_size = atoi(optarg);
+			break;
+		case 'F':
+			pff_thresholds = optarg;
+			break;
+		case 'm':
+			pool_policy = optarg;
+			stream = 1;
+			break;
+		case 'P':
+			partition = atoi(optarg);
+			break;
+		case 'T':
+			tau = atol(optarg);
+			break;
+		case 'W':
+			fault_window = atol(optarg);
+			break;
+		case 'H':
+			if (num_of_regions == MAX_HUGE_REGIONS) {
+				printf("ERROR: At most %d huge page regions are supported\n", MAX_HUGE_REGIONS);
+				free(requests);
+				return EXIT_FAILURE;
+			}
+			regions[num_of_regions++] = optarg;
+			break;
+		case 'L':
+			parse_latency(&latency, optarg);
+			break;
+		case 't':
+			init_tlb(&tlb, optarg);
+			use_tlb = 1;
+			break;
+		case 'p':
+			page_shift = parse_page_size(optarg);
+			if (page_shift < 0) {
+				printf(USAGE);
+				free(requests);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 's':
+			stream = 1;
+			break;
+		case 'w':
+			window_size = atoi(optarg);
+			if (window_size <= 0) {
+				printf("ERROR: The lookahead window must hold at least 1 page\n");
+				free(requests);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			printf(USAGE);
+			free(requests);
+			return EXIT_FAILURE;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	init_find_frame();
+	if (benchmark && argc == 0) {
+		benchmark_find_frame();
+		free(requests);
+		return EXIT_SUCCESS;
+	}
+	if (convert && argc == 2) {
+		convert_trace(argv[0], argv[1]);
+		free(requests);
+		return EXIT_SUCCESS;
+	}
+	if (convert || benchmark || argc < 2) {
+		printf(USAGE);
 		free(requests);
 		return EXIT_FAILURE;
-   } else {
-		input = open_file(argv[1]);
-		
-		fgets(data, sizeof data, input);
-		sscanf(data, "%s%s%s", page_num_data, frame_data, request_data);
-		if (atoi(frame_data) == 0) {
-			printf("ERROR: Cannot have 0 frames as an input\n");
+   } else if (stream) {
+		open_stream_trace(&trace, argv[0], window_size);
+		if (addresses) {
+			init_address_map(&map, page_shift, dedupe);
+			for (i = 0; i < num_of_regions; i++)
+				add_huge_region(&map, regions[i]);
+			trace.map = &map;
+		}
+	} else {
+		input = open_file(argv[0]);
+
+		//Binary traces are recognized by their magic number
+		if (fread(data, 1, 4, input) == 4 && memcmp(data, TRACE_MAGIC, 4) == 0) {
+			fclose(input);
+			open_binary_trace(&trace, argv[0], &header);
+			frame_size = header.num_of_frames;
+		} else {
+			rewind(input);
+			fgets(data, sizeof data, input);
+			sscanf(data, "%s%s%s", page_num_data, frame_data, request_data);
+			frame_size = atoi(frame_data);
+			if (frame_size != 0) {
+				init(requests, input, atoi(page_num_data), atoi(request_data));
+				init_list_trace(&trace, requests);
+			}
+			fclose(input);
+		}
+	}
+	if (frame_size <= 0) {
+		printf("ERROR: Cannot have 0 frames as an input\n");
+		return EXIT_FAILURE;
+	}
+	//Stream mode takes the frame count from -f, so it may be far too large for the stack.
+	//The pool keeps frames of its own, so frame[] is only built for one process.
+	int *frame = NULL;
+	if (pool_policy == NULL) {
+		frame = (int *) malloc(frame_size * sizeof(int));
+		if (frame == NULL) {
+			printf("ERROR: Cannot allocate %d frames\n", frame_size);
 			return EXIT_FAILURE;
 		}
-		int num_of_pages = atoi(page_num_data);
-		int frame[atoi(frame_data)];
-		int frame_size = atoi(frame_data);
-		int num_of_requests = atoi(request_data);
-		
-		init(requests, input, num_of_pages, num_of_requests);
 		init_array(frame, frame_size);
-		
-		if (strcmp(argv[2], "FIFO") == 0) {
-			FIFO(frame, frame_size, requests);
-		} else if (strcmp(argv[2], "LRU") == 0) {
-			LRU(frame, frame_size, requests);
-		} else if (strcmp(argv[2], "OPT") == 0) {
-			OPT(frame, frame_size, requests);
-		} else {
-			printf("\nUsage: simulate <input_file> FIFO|LRU|OPT\n\n");
-			free(requests);
+	}
+	init_stats(&stats, frame_size, quiet, event_file);
+	if (use_tlb) {
+		stats.tlb = &tlb;
+		stats.latency = latency;
+	}
+
+	if (pool_policy != NULL) {
+		//TLB entries carry no process id, so pages of different processes would alias
+		if (use_tlb || addresses || strcmp(argv[1], "OPT") == 0) {
+			printf("ERROR: Multi-process traces support FIFO and LRU without -t or -a\n");
+			return EXIT_FAILURE;
+		}
+		init_pool(&pool, frame_size, pool_policy, partition, fault_window, pff_thresholds);
+		pool.lru = strcmp(argv[1], "LRU") == 0;
+		if (!pool.lru && strcmp(argv[1], "FIFO") != 0) {
+			printf(USAGE);
+			return EXIT_FAILURE;
+		}
+		simulate_processes(&pool, &trace, &stats);
+	} else if (strcmp(argv[1], "FIFO") == 0) {
+		FIFO(frame, frame_size, &trace, &stats);
+	} else if (strcmp(argv[1], "LRU") == 0) {
+		LRU(frame, frame_size, &trace, &stats);
+	} else if (strcmp(argv[1], "OPT") == 0) {
+		OPT(frame, frame_size, &trace, &stats);
+	} else if (strcmp(argv[1], "WS") == 0 || strcmp(argv[1], "WSCLOCK") == 0) {
+		if (tau <= 0 || fault_window <= 0) {
+			printf("ERROR: The working set and fault rate windows must hold at least 1 reference\n");
 			return EXIT_FAILURE;
 		}
+		if (strcmp(argv[1], "WS") == 0)
+			WS(frame, frame_size, &trace, &stats, tau, fault_window);
+		else
+			WSCLOCK(frame, frame_size, &trace, &stats, tau, fault_window);
+	} else {
+		printf(USAGE);
+		free(requests);
+		return EXIT_FAILURE;
 	}
-	
+	print_stats(&stats);
+	if (addresses)
+		print_address_stats(&map);
+	if (pool_policy != NULL)
+		print_pool_stats(&pool);
+
    return EXIT_SUCCESS;
 }
 
@@ -135,6 +606,7 @@ void init_array(int frame[], int size) {
 void add_to_list(List *pages, int page) {
    Node *new = (Node *) malloc(sizeof(Node));
 	new->page = page;
+	new->next = NULL;
 	if (pages->head == NULL) {
 		pages->head = new;
 	} else {
@@ -149,187 +621,1688 @@ void add_to_list(List *pages, int page) {
 }
 
 /**
- * Simulates the FIFO page replacement algorithm
+ * Points the trace at the first node of the page sequence list
  **/
 
-void FIFO(int frame[], int size, List *requests) {
-	Node *temp = requests->head;
-	int replace_index = 0;
-	int i;
-	int page_faults = 0;
-	int frame_detected = 0;
-	int page_fault_flag = 1;
+void init_list_trace(Trace *trace, List *pages) {
+	memset(trace, 0, sizeof(Trace));
+	trace->kind = TRACE_LIST;
+	trace->node = pages->head;
+}
 
-	while(temp != NULL) {
-		for (i = 0; i < size; i++) {
-			if (temp->page == frame[i]) {
-				page_fault_flag = 0;
-				frame_detected = i;
-				break;
-			}
-		}
-		if(page_fault_flag) {
-			if (frame[replace_index] == -1) {
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-			} else {
-				printf("Page %d unloaded into Frame %d, ", frame[replace_index], replace_index);
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-			}
-			if (replace_index + 1 == size)
-				replace_index = 0;
-			else
-				replace_index++;
-			page_faults++;
-		} else {
-			printf("Page %d already in Frame %d\n", temp->page, frame_detected);
-			page_fault_flag = 1;
+/**
+ * Maps a binary trace file into memory and points the trace
+ * at its first block. Nothing is copied out of the mapping.
+ **/
+
+void open_binary_trace(Trace *trace, char *file, TraceHeader *header) {
+	struct stat st;
+	int fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		printf("Error on open %s \n", file);
+		exit(EXIT_FAILURE);
+	}
+	if ((size_t) st.st_size < sizeof(TraceHeader)) {
+		printf("ERROR: %s is too short to be a binary trace\n", file);
+		exit(EXIT_FAILURE);
+	}
+	const unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Error on mmap %s \n", file);
+		exit(EXIT_FAILURE);
+	}
+	madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+	memcpy(header, map, sizeof(TraceHeader));
+	if (header->version != TRACE_VERSION) {
+		printf("ERROR: %s has unsupported trace version %u\n", file, header->version);
+		exit(EXIT_FAILURE);
+	}
+	memset(trace, 0, sizeof(Trace));
+	trace->kind = TRACE_BINARY;
+	trace->pos = map + sizeof(TraceHeader);
+	trace->end = map + st.st_size;
+	check_binary_trace(trace, header, file);
+}
+
+/**
+ * Opens a headerless stream of page numbers, or standard
+ * input when the file is "-", and sizes its lookahead window
+ **/
+
+void open_stream_trace(Trace *trace, char *file, int window_size) {
+	memset(trace, 0, sizeof(Trace));
+	trace->kind = TRACE_STREAM;
+	trace->fd = STDIN_FILENO;
+	if (strcmp(file, "-") != 0) {
+		trace->fd = open(file, O_RDONLY);
+		if (trace->fd < 0) {
+			printf("Error on open %s \n", file);
+			exit(EXIT_FAILURE);
 		}
-		temp = temp->next;
 	}
-	printf("%d page faults\n", page_faults);
+	trace->chunk = (char *) malloc(STREAM_CHUNK_LENGTH);
+	trace->window = (int *) malloc(window_size * sizeof(int));
+	if (trace->chunk == NULL || trace->window == NULL) {
+		printf("ERROR: Cannot allocate a lookahead window of %d pages\n", window_size);
+		exit(EXIT_FAILURE);
+	}
+	trace->window_size = window_size;
 }
 
 /**
- * Simulates the OPT page replacement algorithm
+ * Returns the next character of the stream, reading another
+ * chunk whenever the current one runs out, or -1 at end of stream
  **/
 
-void OPT(int frame[], int size, List *requests) {
-	
-	int frame_detected = 0;
-	int i;
-	int index_replace_time = 0;
-	int longest_replace_time = 0;
-	int replace_index = 0;
-	int page_faults = 0;
-	int page_fault_flag = 1;
-	Node *temp = requests->head;
-
-	while(temp != NULL) {
-		for (i = 0; i < size; i++) {
-			if (temp->page == frame[i]) {
-				page_fault_flag = 0;
-				frame_detected = i;
-				break;
-			}
+static int read_stream_char(Trace *trace) {
+	if (trace->chunk_pos == trace->chunk_length) {
+		ssize_t n = read(trace->fd, trace->chunk, STREAM_CHUNK_LENGTH);
+		if (n < 0) {
+			printf("ERROR: Cannot read the page stream\n");
+			exit(EXIT_FAILURE);
 		}
-		if(page_fault_flag) {
-			if (frame[replace_index] == -1) {
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-				replace_index++;
-			} else {
-				for (i = 0; i < size; i++) {
-					index_replace_time = find_opt_replace_index(frame[i], temp);
-					if (longest_replace_time < index_replace_time) {
-						replace_index = i;
-						longest_replace_time = index_replace_time;
-					}
-				}
-				printf("Page %d unloaded from Frame %d, ", frame[replace_index], replace_index);
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-				longest_replace_time = 0;
+		trace->chunk_pos = 0;
+		trace->chunk_length = n;
+		if (n == 0) {
+			trace->eof = 1;
+			return -1;
+		}
+	}
+	return (unsigned char) trace->chunk[trace->chunk_pos++];
+}
+
+/**
+ * Parses the next page number out of the stream.
+ * Returns 0 at end of stream.
+ **/
+
+static int read_stream_page(Trace *trace, int *page) {
+	long value = 0;
+	int digits = 0;
+	int c;
+	while ((c = read_stream_char(trace)) != -1) {
+		if (c >= '0' && c <= '9') {
+			value = value * 10 + (c - '0');
+			digits++;
+			if (value > 0x7fffffff) {
+				printf("ERROR: Page %ld is too large\n", value);
+				exit(EXIT_FAILURE);
 			}
-			page_faults++;
+		} else if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+			if (digits > 0)
+				break;
 		} else {
-			printf("Page %d already in Frame %d\n", temp->page, frame_detected);
-			page_fault_flag = 1;
+			printf("ERROR: Unexpected character '%c' in the page stream\n", c);
+			exit(EXIT_FAILURE);
 		}
-		temp = temp->next;
 	}
-	printf("%d page faults\n", page_faults);
+	*page = (int) value;
+	return digits > 0;
 }
 
 /**
- * Simulates the LRU page replacement algorithm
+ * Parses a hexadecimal address token, with or without a 0x
+ * prefix and with an optional ",size" suffix as Lackey writes it.
+ * Returns 0 when the token is not an address.
  **/
 
-void LRU(int frame[], int size, List *requests) {
-	
-	int frame_detected = 0;
-	int index_replace_time = 0;
-	int i;
-	int longest_replace_time = 0;
-	int replace_index = 0;
-	int page_faults = 0;
-	int page_fault_flag = 1;
-	Node *temp = requests->head;
-
-	while(temp != NULL) {
-		for (i = 0; i < size; i++) {
-			if (temp->page == frame[i]) {
-				page_fault_flag = 0;
-				frame_detected = i;
+static int parse_address(char *token, uint64_t *address) {
+	char *end;
+	if (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+		token += 2;
+	if (!isxdigit((unsigned char) token[0]))
+		return 0;
+	*address = strtoull(token, &end, 16);
+	return *end == '\0' || *end == ',';
+}
+
+/**
+ * Reads address trace lines until one holds an address and returns
+ * its page. Lines are Lackey-style ("I  0400d7d4,8", " L 1ffefff964,8"),
+ * where the address follows the operation, or perf script output
+ * ("a.out 1234 [001] 100.5: mem-loads: 7ffd1234abcd 401136 main"),
+ * where the addr column follows the last field ending in ':'. The
+ * address is the first hexadecimal token after that field, so the
+ * comm, pid and cpu columns before it are never taken for one. Lines
+ * without one, like Valgrind's "==" banners, are skipped. Returns 0
+ * at end of stream.
+ **/
+
+static int read_stream_address(Trace *trace, int *page) {
+	char line[LINE_LENGTH];
+	uint64_t address;
+	int length;
+	int c;
+	while (!trace->eof) {
+		length = 0;
+		while ((c = read_stream_char(trace)) != -1 && c != '\n') {
+			if (length < LINE_LENGTH - 1)
+				line[length++] = c;
+		}
+		line[length] = '\0';
+		if (line[0] == '=' || line[0] == '#')
+			continue;
+		char *tokens[LINE_LENGTH / 2];
+		char *save;
+		int count = 0;
+		int first = 0;
+		int i;
+		char *token = strtok_r(line, " \t\r", &save);
+		while (token != NULL) {
+			if (token[strlen(token) - 1] == ':')
+				first = count + 1;
+			tokens[count++] = token;
+			token = strtok_r(NULL, " \t\r", &save);
+		}
+		for (i = first; i < count; i++) {
+			if (parse_address(tokens[i], &address)) {
+				*page = map_address(trace->map, address);
+				if (*page >= 0)
+					return 1;
 				break;
 			}
 		}
-		if(page_fault_flag) {
-			if (frame[replace_index] == -1) {
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-				replace_index++;
-			} else {
-				for (i = 0; i < size; i++) {
-					index_replace_time = find_LRU_replace_index(frame[i], temp, requests);
-					if (longest_replace_time < index_replace_time) {
-						replace_index = i;
-						longest_replace_time = index_replace_time;
-					}
-				}
-				printf("Page %d unloaded from Frame %d, ", frame[replace_index], replace_index);
-				frame[replace_index] = temp->page;
-				printf("Page %d loaded into Frame %d\n", temp->page, replace_index);
-				longest_replace_time = 0;
-			}
-			page_faults++;
-		} else {
-			printf("Page %d already in Frame %d\n", temp->page, frame_detected);
-			page_fault_flag = 1;
+	}
+	return 0;
+}
+
+/**
+ * Tops up the lookahead window of a stream trace
+ **/
+
+static void fill_window(Trace *trace) {
+	int page;
+	while (trace->window_count < trace->window_size && !trace->eof) {
+		if (trace->map != NULL ? !read_stream_address(trace, &page) : !read_stream_page(trace, &page))
+			break;
+		trace->window[(trace->window_head + trace->window_count) % trace->window_size] = page;
+		trace->window_count++;
+	}
+}
+
+/**
+ * Converts a page size of 4K, 2M or 1G into its
+ * address shift, or -1 for any other size
+ **/
+
+int parse_page_size(char *size) {
+	if (strcmp(size, "4K") == 0)
+		return PAGE_SHIFT_4K;
+	if (strcmp(size, "2M") == 0)
+		return PAGE_SHIFT_2M;
+	if (strcmp(size, "1G") == 0)
+		return PAGE_SHIFT_1G;
+	return -1;
+}
+
+/**
+ * Initializes an empty address map
+ **/
+
+void init_address_map(AddressMap *map, int page_shift, int dedupe) {
+	memset(map, 0, sizeof(AddressMap));
+	map->page_shift = page_shift;
+	map->dedupe = dedupe;
+	map->last_page = -1;
+	map->capacity = 1024;
+	map->keys = (uint64_t *) calloc(map->capacity, sizeof(uint64_t));
+	map->pages = (int *) malloc(map->capacity * sizeof(int));
+	if (map->keys == NULL || map->pages == NULL) {
+		printf("ERROR: Out of memory for the page table\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Adds a huge page region given as <start>-<end>[:2M|1G]
+ * in hexadecimal. Regions default to 2M pages.
+ **/
+
+void add_huge_region(AddressMap *map, char *region) {
+	char *end;
+	int i = map->num_of_regions;
+	map->region_start[i] = strtoull(region, &end, 16);
+	if (*end != '-') {
+		printf("ERROR: Huge page region %s is not <start>-<end>\n", region);
+		exit(EXIT_FAILURE);
+	}
+	map->region_end[i] = strtoull(end + 1, &end, 16);
+	map->region_shift[i] = PAGE_SHIFT_2M;
+	if (*end == ':')
+		map->region_shift[i] = parse_page_size(end + 1);
+	else if (*end != '\0')
+		map->region_shift[i] = -1;
+	if (map->region_shift[i] < 0 || map->region_end[i] <= map->region_start[i]) {
+		printf("ERROR: Huge page region %s is not <start>-<end>[:2M|1G]\n", region);
+		exit(EXIT_FAILURE);
+	}
+	map->num_of_regions++;
+}
+
+/**
+ * Returns the home slot of a key in an open-addressing table
+ * whose capacity is a power of two
+ **/
+
+static size_t table_home(uint64_t key, size_t capacity) {
+	return (key * 0x9e3779b97f4a7c15ULL) >> 20 & (capacity - 1);
+}
+
+/**
+ * Returns the slot holding the key, or the empty slot where it
+ * belongs. Keys are never 0, which marks an empty slot.
+ **/
+
+static size_t table_slot(const uint64_t *keys, size_t capacity, uint64_t key) {
+	size_t slot = table_home(key, capacity);
+	while (keys[slot] != 0 && keys[slot] != key)
+		slot = (slot + 1) & (capacity - 1);
+	return slot;
+}
+
+/**
+ * Doubles an open-addressing table and rehashes its keys and values.
+ * Returns 0 when the larger table cannot be allocated.
+ **/
+
+static int grow_table(uint64_t **keys, int **values, size_t *capacity) {
+	uint64_t *old_keys = *keys;
+	int *old_values = *values;
+	size_t old_capacity = *capacity;
+	size_t i;
+	*capacity *= 2;
+	*keys = (uint64_t *) calloc(*capacity, sizeof(uint64_t));
+	*values = (int *) malloc(*capacity * sizeof(int));
+	if (*keys == NULL || *values == NULL)
+		return 0;
+	for (i = 0; i < old_capacity; i++) {
+		if (old_keys[i] != 0) {
+			size_t slot = table_slot(*keys, *capacity, old_keys[i]);
+			(*keys)[slot] = old_keys[i];
+			(*values)[slot] = old_values[i];
 		}
-		temp = temp->next;
 	}
-	printf("%d page faults\n", page_faults);
+	free(old_keys);
+	free(old_values);
+	return 1;
 }
 
 /**
- * Searches for the next index to be replaced
- * based on when the page will be accessed in the future
+ * Maps an address to the page number of the page holding it.
+ * Returns -1 when deduplication drops a repeat of the last page.
  **/
 
-int find_opt_replace_index(int page, Node *current) {
-	Node *temp = current->next;
-	int time = 10000000;
-	int jumps = 1;
-	while(temp != NULL) {
-		if (temp->page == page) {
-			time = jumps;
+int map_address(AddressMap *map, uint64_t address) {
+	int shift = map->page_shift;
+	int i;
+	map->addresses++;
+	for (i = 0; i < map->num_of_regions; i++) {
+		if (address >= map->region_start[i] && address < map->region_end[i]) {
+			shift = map->region_shift[i];
 			break;
-		} else {
-			jumps++;
 		}
-		temp = temp->next;
 	}
-	
-	return time;
+	//Keep the page size in the low bits so a 4K and a 2M page never collide
+	uint64_t key = ((address >> shift) << 2 | (shift - PAGE_SHIFT_4K) / 9) + 1;
+	size_t slot = table_slot(map->keys, map->capacity, key);
+	if (map->keys[slot] == 0) {
+		if (map->count > 0x7fffffff) {
+			printf("ERROR: More distinct pages than page numbers\n");
+			exit(EXIT_FAILURE);
+		}
+		map->keys[slot] = key;
+		map->pages[slot] = map->count++;
+		map->pages_by_shift[(shift - PAGE_SHIFT_4K) / 9]++;
+		//Double the table once it is half full
+		if (map->count * 2 > map->capacity && !grow_table(&map->keys, &map->pages, &map->capacity)) {
+			printf("ERROR: Out of memory for %zu distinct pages\n", map->count);
+			exit(EXIT_FAILURE);
+		}
+		slot = table_slot(map->keys, map->capacity, key);
+	}
+	int page = map->pages[slot];
+	if (map->dedupe && page == map->last_page) {
+		map->duplicates++;
+		return -1;
+	}
+	map->last_page = page;
+	return page;
 }
 
 /**
- * Searches for the next index to be replaced
- * based on past information about the pages accessed
+ * Prints how the addresses mapped onto pages of each size
  **/
 
-int find_LRU_replace_index(int page, Node *current, List* requests) {
-	Node *temp = requests->head;
-	int time = 0;
-	int jumps = 0;
-	while(temp != current) {
-		if (temp->page == page)
-			time = jumps;
-		jumps++;
-		temp = temp->next;
+void print_address_stats(AddressMap *map) {
+	printf("%ld addresses, %ld consecutive same-page accesses dropped\n", map->addresses, map->duplicates);
+	printf("%zu distinct pages: %ld 4K, %ld 2M, %ld 1G\n", map->count,
+	       map->pages_by_shift[0], map->pages_by_shift[1], map->pages_by_shift[2]);
+}
+
+/**
+ * Encodes a value as a little-endian base 128 varint
+ * and returns the number of bytes written
+ **/
+
+static int put_varint(unsigned char *out, uint32_t value) {
+	int len = 0;
+	while (value >= 0x80) {
+		out[len++] = (unsigned char) (value | 0x80);
+		value >>= 7;
 	}
-	
-	return jumps - time;
-}
\ No newline at end of file
+	out[len++] = (unsigned char) value;
+	return len;
+}
+
+/**
+ * Decodes a varint that must end before end and moves the position
+ * past it. Returns 0 when it runs past end or over MAX_VARINT_BYTES.
+ **/
+
+static int get_varint(const unsigned char **pos, const unsigned char *end, uint32_t *value) {
+	const unsigned char *p = *pos;
+	int shift = 0;
+	*value = 0;
+	do {
+		if (p == end || shift == 7 * MAX_VARINT_BYTES)
+			return 0;
+		*value |= (uint32_t) (*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*pos = p;
+	return 1;
+}
+
+/**
+ * Walks every block of a binary trace once before it is simulated.
+ * Each block must fit in the file and decode to exactly its reference
+ * count within its byte length, every page must lie within the # of
+ * pages, and the blocks and references must add up to the totals of
+ * the file header.
+ **/
+
+void check_binary_trace(Trace *trace, TraceHeader *header, char *file) {
+	const unsigned char *pos = trace->pos;
+	uint64_t requests = 0;
+	uint32_t blocks = 0;
+	uint32_t value;
+	while (pos < trace->end) {
+		BlockHeader block_header;
+		if (trace->end - pos < (long) sizeof(BlockHeader)) {
+			printf("ERROR: %s ends inside the header of block %u\n", file, blocks);
+			exit(EXIT_FAILURE);
+		}
+		memcpy(&block_header, pos, sizeof(BlockHeader));
+		pos += sizeof(BlockHeader);
+		if (block_header.length > (uint64_t) (trace->end - pos)) {
+			printf("ERROR: Block %u of %s is %u bytes long but only %ld are left\n",
+			       blocks, file, block_header.length, (long) (trace->end - pos));
+			exit(EXIT_FAILURE);
+		}
+		const unsigned char *block_end = pos + block_header.length;
+		uint32_t count = 0;
+		int64_t page = 0;
+		while (pos < block_end && get_varint(&pos, block_end, &value)) {
+			page += (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+			if (page < 0 || page > header->num_of_pages) {
+				printf("ERROR: Page %lld of block %u of %s falls outside of the # of pages\n",
+				       (long long) page, blocks, file);
+				exit(EXIT_FAILURE);
+			}
+			count++;
+		}
+		if (pos != block_end || count != block_header.count || count == 0) {
+			printf("ERROR: Block %u of %s holds %u page requests but its header specifies %u\n",
+			       blocks, file, count, block_header.count);
+			exit(EXIT_FAILURE);
+		}
+		requests += count;
+		blocks++;
+	}
+	if (blocks != header->num_of_blocks || requests != header->num_of_requests) {
+		printf("ERROR: # of page requests (%llu in %u blocks) do not match the # specified in the file (%llu in %u blocks)\n",
+		       (unsigned long long) requests, blocks,
+		       (unsigned long long) header->num_of_requests, header->num_of_blocks);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Writes the encoded references of a block behind its block header
+ **/
+
+static void write_block(FILE *output, unsigned char *block, uint32_t count, uint32_t length) {
+	BlockHeader block_header;
+	block_header.count = count;
+	block_header.length = length;
+	fwrite(&block_header, sizeof(BlockHeader), 1, output);
+	fwrite(block, 1, length, output);
+}
+
+/**
+ * Converts a text trace into the binary trace format. The text
+ * trace is read one line at a time so it never has to fit in memory.
+ **/
+
+void convert_trace(char *text_file, char *binary_file) {
+	char data[BUFFER_LENGTH];
+	char page_num_data[BUFFER_LENGTH];
+	char frame_data[BUFFER_LENGTH];
+	char request_data[BUFFER_LENGTH];
+	unsigned char block[TRACE_BLOCK_REFS * MAX_VARINT_BYTES];
+	TraceHeader header;
+	uint32_t count = 0;
+	uint32_t length = 0;
+	int prev = 0;
+	FILE *input = open_file(text_file);
+	FILE *output = fopen(binary_file, "w");
+
+	if (output == NULL) {
+		printf("Error on fopen %s \n", binary_file);
+		exit(EXIT_FAILURE);
+	}
+	if (fgets(data, sizeof data, input) == NULL
+	    || sscanf(data, "%s%s%s", page_num_data, frame_data, request_data) != 3) {
+		printf("ERROR: %s is missing the page, frame and request header\n", text_file);
+		exit(EXIT_FAILURE);
+	}
+	memset(&header, 0, sizeof(TraceHeader));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	header.num_of_pages = atoi(page_num_data);
+	header.num_of_frames = atoi(frame_data);
+	header.block_refs = TRACE_BLOCK_REFS;
+	fwrite(&header, sizeof(TraceHeader), 1, output);
+
+	while (fgets(data, sizeof data, input)) {
+		char page_data[BUFFER_LENGTH];
+		sscanf(data, "%s", page_data);
+		int page = atoi(page_data);
+		if (page > (int) header.num_of_pages || page < 0) {
+			printf("ERROR: Page %d cannot be added because it falls outside of the # of pages\n", page);
+			remove(binary_file);
+			exit(EXIT_FAILURE);
+		}
+		//Zigzag the delta so small steps down stay small too
+		int32_t delta = page - prev;
+		length += put_varint(block + length, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+		prev = page;
+		count++;
+		header.num_of_requests++;
+		if (count == TRACE_BLOCK_REFS) {
+			write_block(output, block, count, length);
+			header.num_of_blocks++;
+			count = 0;
+			length = 0;
+			prev = 0;
+		}
+	}
+	if (count > 0) {
+		write_block(output, block, count, length);
+		header.num_of_blocks++;
+	}
+	fclose(input);
+
+	if (header.num_of_requests != (uint64_t) atoll(request_data)) {
+		printf("ERROR: # of page requests do not match # of page requests specified in the file\n");
+		fclose(output);
+		remove(binary_file);
+		exit(EXIT_FAILURE);
+	}
+	rewind(output);
+	fwrite(&header, sizeof(TraceHeader), 1, output);
+	fclose(output);
+	printf("%llu page requests written to %s in %u blocks\n",
+	       (unsigned long long) header.num_of_requests, binary_file, header.num_of_blocks);
+}
+
+/**
+ * Reads the next page of the trace. Returns 0 once
+ * the trace is exhausted.
+ **/
+
+int trace_next(Trace *trace, int *page) {
+	if (trace->kind == TRACE_LIST) {
+		if (trace->node == NULL)
+			return 0;
+		*page = trace->node->page;
+		trace->node = trace->node->next;
+		return 1;
+	}
+	if (trace->kind == TRACE_STREAM) {
+		fill_window(trace);
+		if (trace->window_count == 0)
+			return 0;
+		*page = trace->window[trace->window_head];
+		trace->window_head = (trace->window_head + 1) % trace->window_size;
+		trace->window_count--;
+		return 1;
+	}
+	if (trace->left == 0) {
+		BlockHeader block_header;
+		if (trace->end - trace->pos < (long) sizeof(BlockHeader))
+			return 0;
+		memcpy(&block_header, trace->pos, sizeof(BlockHeader));
+		trace->pos += sizeof(BlockHeader);
+		trace->left = block_header.count;
+		trace->prev = 0;
+		if (trace->left == 0 || block_header.length > (uint64_t) (trace->end - trace->pos))
+			return 0;
+		trace->block_end = trace->pos + block_header.length;
+	}
+	uint32_t zigzag;
+	if (!get_varint(&trace->pos, trace->block_end, &zigzag))
+		return 0;
+	trace->prev += (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+	trace->left--;
+	*page = trace->prev;
+	return 1;
+}
+
+/**
+ * Reads the next "pid page" pair of a multi-process stream.
+ * Returns 0 once the trace is exhausted.
+ **/
+
+int trace_next_process(Trace *trace, int *pid, int *page) {
+	if (!read_stream_page(trace, pid))
+		return 0;
+	if (!read_stream_page(trace, page)) {
+		printf("ERROR: Process %d has no page for its last reference\n", *pid);
+		exit(EXIT_FAILURE);
+	}
+	return 1;
+}
+
+/**
+ * Scalar frame search, the fallback on CPUs without vector support
+ **/
+
+static int find_frame_scalar(const int *frame, int size, int page) {
+	int i;
+	for (i = 0; i < size; i++) {
+		if (frame[i] == page)
+			return i;
+	}
+	return -1;
+}
+
+#ifdef __SSE2__
+/**
+ * Compares 4 frames at a time and picks the first match out of
+ * the movemask
+ **/
+
+static int find_frame_sse2(const int *frame, int size, int page) {
+	__m128i key = _mm_set1_epi32(page);
+	int i;
+	for (i = 0; i + 4 <= size; i += 4) {
+		__m128i pages = _mm_loadu_si128((const __m128i *) (frame + i));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(pages, key)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	for (; i < size; i++) {
+		if (frame[i] == page)
+			return i;
+	}
+	return -1;
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNEL
+/**
+ * Compares 16 frames per iteration with two 8-lane AVX2 compares
+ **/
+
+__attribute__((target("avx2")))
+static int find_frame_avx2(const int *frame, int size, int page) {
+	__m256i key = _mm256_set1_epi32(page);
+	int i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m256i low = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (frame + i)), key);
+		__m256i high = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (frame + i + 8)), key);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(low))
+		         | _mm256_movemask_ps(_mm256_castsi256_ps(high)) << 8;
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	for (; i + 8 <= size; i += 8) {
+		__m256i pages = _mm256_loadu_si256((const __m256i *) (frame + i));
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(pages, key)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	if (i + 4 <= size) {
+		__m128i pages = _mm_loadu_si128((const __m128i *) (frame + i));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(pages, _mm256_castsi256_si128(key))));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+		i += 4;
+	}
+	for (; i < size; i++) {
+		if (frame[i] == page)
+			return i;
+	}
+	return -1;
+}
+#endif
+
+static int (*find_frame_kernel)(const int *frame, int size, int page) = find_frame_scalar;
+static int (*find_frame_narrow)(const int *frame, int size, int page) = find_frame_scalar;
+static const char *find_frame_name = "scalar";
+
+/**
+ * Picks the widest frame search the CPU supports. Below
+ * WIDE_SEARCH_FRAMES frames AVX2 loses to SSE2, so those keep
+ * the narrow kernel, and below SCALAR_SEARCH_FRAMES the plain loop
+ * beats both.
+ **/
+
+void init_find_frame(void) {
+#ifdef __SSE2__
+	find_frame_kernel = find_frame_sse2;
+	find_frame_narrow = find_frame_sse2;
+	find_frame_name = "sse2";
+#endif
+#ifdef HAVE_AVX2_KERNEL
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		find_frame_kernel = find_frame_avx2;
+		find_frame_name = "avx2";
+	}
+#endif
+}
+
+/**
+ * Searches the frames for the given page and returns
+ * its frame index, or -1 when the page is not loaded
+ **/
+
+int find_frame(int frame[], int size, int page) {
+	if (size < SCALAR_SEARCH_FRAMES)
+		return find_frame_scalar(frame, size, page);
+	if (size < WIDE_SEARCH_FRAMES)
+		return find_frame_narrow(frame, size, page);
+	return find_frame_kernel(frame, size, page);
+}
+
+/**
+ * Times one frame search kernel over the given lookups
+ * and returns its cost in ns per lookup
+ **/
+
+static double time_find_frame(int (*kernel)(const int *, int, int), const int *frame, int size,
+                              const int *lookups, long count, long *checksum) {
+	struct timespec start;
+	struct timespec end;
+	long i;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < count; i++)
+		*checksum += kernel(frame, size, lookups[i & (BENCH_MAX_FRAMES - 1)]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count;
+}
+
+/**
+ * Compares the scalar frame search against the vector kernels
+ * for 4 to 4096 frames. Half of the lookups hit a random frame and
+ * half miss, so both the early exit and the full scan are timed.
+ **/
+
+void benchmark_find_frame(void) {
+	static int frame[BENCH_MAX_FRAMES];
+	static int lookups[BENCH_MAX_FRAMES];
+	long checksum = 0;
+	int size;
+	int i;
+
+	srand(1);
+	printf("Frame search in ns per lookup, %s selected\n", find_frame_name);
+	printf("%8s %10s %10s %10s\n", "Frames", "scalar", "sse2", "avx2");
+	for (size = 4; size <= BENCH_MAX_FRAMES; size *= 2) {
+		long count = BENCH_LOOKUPS / size;
+		for (i = 0; i < size; i++)
+			frame[i] = i * 2;
+		for (i = 0; i < BENCH_MAX_FRAMES; i++)
+			lookups[i] = (rand() % size) * 2 + (rand() & 1);
+		printf("%8d %10.2f", size, time_find_frame(find_frame_scalar, frame, size, lookups, count, &checksum));
+#ifdef __SSE2__
+		printf(" %10.2f", time_find_frame(find_frame_sse2, frame, size, lookups, count, &checksum));
+#else
+		printf(" %10s", "-");
+#endif
+#ifdef HAVE_AVX2_KERNEL
+		if (__builtin_cpu_supports("avx2"))
+			printf(" %10.2f\n", time_find_frame(find_frame_avx2, frame, size, lookups, count, &checksum));
+		else
+			printf(" %10s\n", "-");
+#else
+		printf(" %10s\n", "-");
+#endif
+	}
+	//Keeps the compiler from dropping the timed calls
+	if (checksum == 42)
+		printf("\n");
+}
+
+/**
+ * Sets up the counters of a run and opens the
+ * event file when one was requested
+ **/
+
+void init_stats(Stats *stats, int size, int quiet, char *event_file) {
+	memset(stats, 0, sizeof(Stats));
+	stats->quiet = quiet;
+	stats->size = size;
+	stats->evictions = (long *) calloc(size, sizeof(long));
+	if (stats->evictions == NULL) {
+		printf("ERROR: Cannot allocate the counters of %d frames\n", size);
+		exit(EXIT_FAILURE);
+	}
+	stats->event_fd = -1;
+	if (event_file != NULL) {
+		stats->event_fd = open(event_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (stats->event_fd < 0) {
+			printf("Error on open %s \n", event_file);
+			exit(EXIT_FAILURE);
+		}
+		stats->events = (unsigned char *) malloc(EVENT_BUFFER_LENGTH);
+		if (stats->events == NULL) {
+			printf("ERROR: Cannot allocate the event buffer for %s\n", event_file);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+ * Appends an event to the event buffer, writing the
+ * buffer out whenever it fills up
+ **/
+
+static void write_event(Stats *stats, int type, int page, int frame, int evicted) {
+	Event event;
+	if (stats->event_fd < 0)
+		return;
+	if (stats->event_length + sizeof(Event) > EVENT_BUFFER_LENGTH)
+		flush_events(stats);
+	memset(&event, 0, sizeof(Event));
+	event.type = type;
+	event.page = page;
+	event.frame = frame;
+	event.evicted = evicted;
+	memcpy(stats->events + stats->event_length, &event, sizeof(Event));
+	stats->event_length += sizeof(Event);
+}
+
+/**
+ * Records a reference to a page that is already loaded
+ **/
+
+void record_hit(Stats *stats, int page, int frame) {
+	stats->references++;
+	if (stats->tlb != NULL)
+		tlb_access(stats->tlb, page);
+	if (!stats->quiet)
+		printf("Page %d already in Frame %d\n", page, frame);
+	write_event(stats, EVENT_HIT, page, frame, -1);
+}
+
+/**
+ * Records a page fault that loaded the page into the frame,
+ * unloading the evicted page first unless it is -1
+ **/
+
+void record_load(Stats *stats, int page, int frame, int evicted) {
+	stats->references++;
+	stats->page_faults++;
+	if (evicted != -1)
+		stats->evictions[frame]++;
+	if (stats->tlb != NULL) {
+		if (evicted != -1)
+			tlb_invalidate(stats->tlb, evicted);
+		tlb_access(stats->tlb, page);
+	}
+	if (!stats->quiet) {
+		if (evicted != -1)
+			printf("Page %d unloaded from Frame %d, ", evicted, frame);
+		printf("Page %d loaded into Frame %d\n", page, frame);
+	}
+	write_event(stats, EVENT_LOAD, page, frame, evicted);
+}
+
+/**
+ * Records a page leaving the working set, which frees its frame
+ * without a fault. No event is written so the event index stays
+ * the virtual time.
+ **/
+
+void record_unload(Stats *stats, int page, int frame) {
+	stats->evictions[frame]++;
+	if (stats->tlb != NULL)
+		tlb_invalidate(stats->tlb, page);
+	if (!stats->quiet)
+		printf("Page %d left the working set, Frame %d freed\n", page, frame);
+}
+
+/**
+ * Prints one point of the working set time series and
+ * starts counting the faults of the next window
+ **/
+
+void record_window(Stats *stats, long window, int working_set, long *window_faults) {
+	long faults = stats->page_faults - *window_faults;
+	printf("Window %ld: working set %d pages, %ld page faults, fault rate %.4f\n",
+	       stats->references / window, working_set, faults, (double) faults / window);
+	*window_faults = stats->page_faults;
+}
+
+/**
+ * Writes the buffered events to the event file
+ **/
+
+void flush_events(Stats *stats) {
+	size_t written = 0;
+	while (written < stats->event_length) {
+		ssize_t n = write(stats->event_fd, stats->events + written, stats->event_length - written);
+		if (n < 0) {
+			printf("ERROR: Cannot write the event file\n");
+			exit(EXIT_FAILURE);
+		}
+		written += n;
+	}
+	stats->event_length = 0;
+}
+
+/**
+ * Prints the page fault count, plus the hit ratio and the
+ * evictions of every frame in quiet mode, and closes the event file
+ **/
+
+void print_stats(Stats *stats) {
+	int i;
+	printf("%ld page faults\n", stats->page_faults);
+	if (stats->quiet) {
+		printf("%ld page requests, hit ratio %.4f\n", stats->references,
+		       stats->references ? 1.0 - (double) stats->page_faults / stats->references : 0.0);
+		for (i = 0; i < stats->size; i++)
+			printf("Frame %d: %ld evictions\n", i, stats->evictions[i]);
+	}
+	if (stats->tlb != NULL && stats->references > 0) {
+		//Every reference looks up the TLB and then memory, misses also walk
+		//the page table and faults swap the page in before the access
+		Tlb *tlb = stats->tlb;
+		double references = stats->references;
+		double tlb_time = stats->latency.tlb;
+		double walk_time = tlb->misses * stats->latency.walk / references;
+		double swap_time = stats->page_faults * stats->latency.swap / references;
+		double memory_time = stats->latency.memory;
+		printf("TLB: %ld hits, %ld misses, hit ratio %.4f\n", tlb->hits, tlb->misses, tlb->hits / references);
+		printf("Page table: %ld walks\n", tlb->misses);
+		printf("Swap: %ld swap-ins\n", stats->page_faults);
+		printf("Effective memory access time: %.2f ns\n", tlb_time + walk_time + memory_time + swap_time);
+		printf("  TLB lookups: %.2f ns\n", tlb_time);
+		printf("  Page walks: %.2f ns\n", walk_time);
+		printf("  Memory: %.2f ns\n", memory_time);
+		printf("  Swap-ins: %.2f ns\n", swap_time);
+	}
+	if (stats->event_fd >= 0) {
+		flush_events(stats);
+		close(stats->event_fd);
+		free(stats->events);
+	}
+	free(stats->evictions);
+}
+
+/**
+ * Builds an empty TLB from a geometry of <entries>:<ways>
+ **/
+
+void init_tlb(Tlb *tlb, char *geometry) {
+	int entries = 0;
+	int ways = 0;
+	memset(tlb, 0, sizeof(Tlb));
+	if (sscanf(geometry, "%d:%d", &entries, &ways) != 2 || entries <= 0 || ways <= 0
+	    || entries % ways != 0) {
+		printf("ERROR: TLB geometry %s must be <entries>:<ways> with ways dividing entries\n", geometry);
+		exit(EXIT_FAILURE);
+	}
+	tlb->ways = ways;
+	tlb->sets = entries / ways;
+	//Padding each set to whole vectors can push the slots past an int
+	size_t stride = ((size_t) ways + TLB_LANES - 1) / TLB_LANES * TLB_LANES;
+	size_t slots = tlb->sets * stride;
+	if (slots > 0x7fffffff) {
+		printf("ERROR: TLB geometry %s holds too many entries\n", geometry);
+		exit(EXIT_FAILURE);
+	}
+	tlb->stride = (int) stride;
+	tlb->tags = (int *) aligned_alloc(16, slots * sizeof(int));
+	tlb->stamps = (long *) calloc(slots, sizeof(long));
+	if (tlb->tags == NULL || tlb->stamps == NULL) {
+		printf("ERROR: Cannot allocate a TLB of %d entries\n", entries);
+		exit(EXIT_FAILURE);
+	}
+	init_array(tlb->tags, (int) slots);
+}
+
+/**
+ * Reads the <tlb>,<walk>,<memory>,<swap> latencies in ns
+ **/
+
+void parse_latency(Latency *latency, char *latencies) {
+	if (sscanf(latencies, "%lf,%lf,%lf,%lf", &latency->tlb, &latency->walk,
+	           &latency->memory, &latency->swap) != 4) {
+		printf("ERROR: Latencies %s must be <tlb>,<walk>,<memory>,<swap>\n", latencies);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Returns the way of the set holding the page, or -1
+ **/
+
+static int tlb_find_way(const int *set, int stride, int page) {
+	int i;
+#ifdef __SSE2__
+	__m128i key = _mm_set1_epi32(page);
+	for (i = 0; i < stride; i += TLB_LANES) {
+		__m128i tags = _mm_load_si128((const __m128i *) (set + i));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(tags, key)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	for (i = 0; i < stride; i++) {
+		if (set[i] == page)
+			return i;
+	}
+#endif
+	return -1;
+}
+
+/**
+ * Looks the page up in the TLB, filling the least recently
+ * used way of its set on a miss
+ **/
+
+void tlb_access(Tlb *tlb, int page) {
+	int base = (page % tlb->sets) * tlb->stride;
+	int way = tlb_find_way(tlb->tags + base, tlb->stride, page);
+	int i;
+	tlb->clock++;
+	if (way >= 0) {
+		tlb->hits++;
+	} else {
+		tlb->misses++;
+		way = 0;
+		for (i = 0; i < tlb->ways; i++) {
+			if (tlb->tags[base + i] == -1) {
+				way = i;
+				break;
+			}
+			if (tlb->stamps[base + i] < tlb->stamps[base + way])
+				way = i;
+		}
+		tlb->tags[base + way] = page;
+	}
+	tlb->stamps[base + way] = tlb->clock;
+}
+
+/**
+ * Drops the page from the TLB once it is unloaded from its frame
+ **/
+
+void tlb_invalidate(Tlb *tlb, int page) {
+	int base = (page % tlb->sets) * tlb->stride;
+	int way = tlb_find_way(tlb->tags + base, tlb->stride, page);
+	if (way >= 0)
+		tlb->tags[base + way] = -1;
+}
+
+/**
+ * Sets up a pool of free frames for the global, local or
+ * pff policy. partition is the fixed partition of local replacement
+ * and the initial allocation of pff, an eighth of the pool by default,
+ * and is cut down to the frames left unallocated when a process shows up.
+ **/
+
+void init_pool(Pool *pool, int size, char *policy, int partition, long window, char *thresholds) {
+	int i;
+	memset(pool, 0, sizeof(Pool));
+	if (strcmp(policy, "global") == 0) {
+		pool->policy = POOL_GLOBAL;
+	} else if (strcmp(policy, "local") == 0) {
+		pool->policy = POOL_LOCAL;
+	} else if (strcmp(policy, "pff") == 0) {
+		pool->policy = POOL_PFF;
+	} else {
+		printf("ERROR: Frame allocation %s is not global, local or pff\n", policy);
+		exit(EXIT_FAILURE);
+	}
+	if (sscanf(thresholds, "%lf,%lf", &pool->lower, &pool->upper) != 2 || pool->lower > pool->upper) {
+		printf("ERROR: Fault rate thresholds %s must be <lower>,<upper>\n", thresholds);
+		exit(EXIT_FAILURE);
+	}
+	if (window <= 0) {
+		printf("ERROR: The fault rate window must hold at least 1 reference\n");
+		exit(EXIT_FAILURE);
+	}
+	pool->size = size;
+	pool->window = window;
+	pool->partition = partition > 0 ? partition : (size / 8 > 0 ? size / 8 : 1);
+	pool->frames = (PoolFrame *) malloc(size * sizeof(PoolFrame));
+	for (i = 0; i < size; i++)
+		pool->frames[i].gnext = i + 1 < size ? i + 1 : -1;
+	pool->free_head = 0;
+	pool->head = -1;
+	pool->tail = -1;
+	pool->capacity = 16;
+	while (pool->capacity < (size_t) size * 2)
+		pool->capacity *= 2;
+	pool->keys = (uint64_t *) calloc(pool->capacity, sizeof(uint64_t));
+	pool->slots = (int *) malloc(pool->capacity * sizeof(int));
+	pool->pid_capacity = 64;
+	pool->pid_keys = (uint64_t *) calloc(pool->pid_capacity, sizeof(uint64_t));
+	pool->pid_indices = (int *) malloc(pool->pid_capacity * sizeof(int));
+	if (pool->frames == NULL || pool->keys == NULL || pool->slots == NULL
+	    || pool->pid_keys == NULL || pool->pid_indices == NULL) {
+		printf("ERROR: Cannot allocate a pool of %d frames\n", size);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Returns the index of a process in the process table, adding the
+ * process the first time its pid shows up. Under local and pff a new
+ * process gets its partition out of the unallocated frames, so the
+ * allocations never add up to more than the pool.
+ **/
+
+static int pool_process(Pool *pool, int pid) {
+	uint64_t key = (uint64_t) pid + 1;
+	size_t slot = table_slot(pool->pid_keys, pool->pid_capacity, key);
+	if (pool->pid_keys[slot] != 0)
+		return pool->pid_indices[slot];
+
+	if (pool->num_of_processes == pool->process_capacity) {
+		pool->process_capacity = pool->process_capacity > 0 ? pool->process_capacity * 2 : 64;
+		pool->processes = (Process *) realloc(pool->processes, pool->process_capacity * sizeof(Process));
+		if (pool->processes == NULL) {
+			printf("ERROR: Out of memory for process %d\n", pid);
+			exit(EXIT_FAILURE);
+		}
+	}
+	int index = pool->num_of_processes++;
+	Process *process = &pool->processes[index];
+	memset(process, 0, sizeof(Process));
+	process->pid = pid;
+	process->head = -1;
+	process->tail = -1;
+	if (pool->policy != POOL_GLOBAL) {
+		long available = pool->size - pool->allocated;
+		process->allocation = pool->partition < available ? pool->partition : (int) available;
+		if (process->allocation == 0) {
+			printf("ERROR: No frames left for process %d, the pool of %d frames is allocated to %d processes\n",
+			       pid, pool->size, index);
+			exit(EXIT_FAILURE);
+		}
+		pool->allocated += process->allocation;
+	}
+
+	pool->pid_keys[slot] = key;
+	pool->pid_indices[slot] = index;
+	//Double the pid table once it is half full
+	if ((size_t) pool->num_of_processes * 2 > pool->pid_capacity
+	    && !grow_table(&pool->pid_keys, &pool->pid_indices, &pool->pid_capacity)) {
+		printf("ERROR: Out of memory for process %d\n", pid);
+		exit(EXIT_FAILURE);
+	}
+	return index;
+}
+
+static uint64_t pool_key(int process, int page) {
+	return ((uint64_t) process << 32 | (uint32_t) page) + 1;
+}
+
+/**
+ * Removes a key, shifting later keys of its probe run back
+ * so lookups never need tombstones
+ **/
+
+static void pool_remove_key(Pool *pool, uint64_t key) {
+	size_t mask = pool->capacity - 1;
+	size_t hole = table_slot(pool->keys, pool->capacity, key);
+	size_t slot = hole;
+	pool->keys[hole] = 0;
+	while (1) {
+		slot = (slot + 1) & mask;
+		if (pool->keys[slot] == 0)
+			return;
+		size_t home = table_home(pool->keys[slot], pool->capacity);
+		//Move the key back unless its home lies cyclically in (hole, slot]
+		if ((slot > hole && (home <= hole || home > slot)) || (slot < hole && home <= hole && home > slot)) {
+			pool->keys[hole] = pool->keys[slot];
+			pool->slots[hole] = pool->slots[slot];
+			pool->keys[slot] = 0;
+			hole = slot;
+		}
+	}
+}
+
+/**
+ * Moves a frame to the tail of the pool-wide and process lists
+ **/
+
+static void pool_link(Pool *pool, Process *process, int index) {
+	PoolFrame *frame = &pool->frames[index];
+	frame->gprev = pool->tail;
+	frame->gnext = -1;
+	if (pool->tail >= 0)
+		pool->frames[pool->tail].gnext = index;
+	else
+		pool->head = index;
+	pool->tail = index;
+	frame->pprev = process->tail;
+	frame->pnext = -1;
+	if (process->tail >= 0)
+		pool->frames[process->tail].pnext = index;
+	else
+		process->head = index;
+	process->tail = index;
+}
+
+static void pool_unlink(Pool *pool, Process *process, int index) {
+	PoolFrame *frame = &pool->frames[index];
+	if (frame->gprev >= 0)
+		pool->frames[frame->gprev].gnext = frame->gnext;
+	else
+		pool->head = frame->gnext;
+	if (frame->gnext >= 0)
+		pool->frames[frame->gnext].gprev = frame->gprev;
+	else
+		pool->tail = frame->gprev;
+	if (frame->pprev >= 0)
+		pool->frames[frame->pprev].pnext = frame->pnext;
+	else
+		process->head = frame->pnext;
+	if (frame->pnext >= 0)
+		pool->frames[frame->pnext].pprev = frame->pprev;
+	else
+		process->tail = frame->pprev;
+}
+
+/**
+ * Unloads the page of a resident frame, leaving the frame unlinked
+ **/
+
+static void pool_evict(Pool *pool, int index) {
+	PoolFrame *frame = &pool->frames[index];
+	Process *owner = &pool->processes[frame->process];
+	pool_unlink(pool, owner, index);
+	pool_remove_key(pool, pool_key(frame->process, frame->page));
+	owner->resident--;
+}
+
+/**
+ * Picks the frame a faulting process loads its page into and sets
+ * the page unloaded from it, or -1. Local and pff processes replace
+ * their own pages once they hold their allocation; below it a free
+ * frame is always left, since no process holds more than its
+ * allocation and the allocations fit in the pool.
+ **/
+
+static int pool_victim(Pool *pool, Process *process, int *evicted) {
+	int index;
+	if (pool->policy != POOL_GLOBAL && process->resident >= process->allocation) {
+		index = process->head;
+	} else if (pool->free_head >= 0) {
+		index = pool->free_head;
+		pool->free_head = pool->frames[index].gnext;
+		*evicted = -1;
+		return index;
+	} else {
+		index = pool->head;
+	}
+	*evicted = pool->frames[index].page;
+	pool_evict(pool, index);
+	return index;
+}
+
+/**
+ * Closes a window of a process's references. A fault rate above
+ * the upper threshold while no frame is free counts as thrashing.
+ * pff grants an unallocated frame above the upper threshold and gives
+ * one back below the lower one.
+ **/
+
+static void pool_window(Pool *pool, Process *process) {
+	double rate = (double) process->window_faults / process->window_references;
+	process->windows++;
+	if (rate > pool->upper && pool->free_head < 0)
+		process->thrashing_windows++;
+	if (pool->policy == POOL_PFF) {
+		if (rate > pool->upper && pool->allocated < pool->size) {
+			process->allocation++;
+			pool->allocated++;
+		} else if (rate < pool->lower && process->allocation > 1) {
+			process->allocation--;
+			pool->allocated--;
+			if (process->resident > process->allocation) {
+				int index = process->head;
+				pool_evict(pool, index);
+				pool->frames[index].gnext = pool->free_head;
+				pool->free_head = index;
+			}
+		}
+	}
+	process->window_references = 0;
+	process->window_faults = 0;
+}
+
+/**
+ * Simulates FIFO or LRU replacement of a multi-process trace
+ * over the shared frame pool
+ **/
+
+void simulate_processes(Pool *pool, Trace *requests, Stats *stats) {
+	int pid;
+	int page;
+
+	while (trace_next_process(requests, &pid, &page)) {
+		int number = pool_process(pool, pid);
+		Process *process = &pool->processes[number];
+		uint64_t key = pool_key(number, page);
+		size_t slot = table_slot(pool->keys, pool->capacity, key);
+		process->references++;
+		process->window_references++;
+		if (!stats->quiet)
+			printf("Process %d: ", pid);
+		if (pool->keys[slot] != 0) {
+			int index = pool->slots[slot];
+			if (pool->lru) {
+				pool_unlink(pool, process, index);
+				pool_link(pool, process, index);
+			}
+			record_hit(stats, page, index);
+		} else {
+			int evicted;
+			int index = pool_victim(pool, process, &evicted);
+			record_load(stats, page, index, evicted);
+			pool->frames[index].process = number;
+			pool->frames[index].page = page;
+			pool_link(pool, process, index);
+			slot = table_slot(pool->keys, pool->capacity, key);
+			pool->keys[slot] = key;
+			pool->slots[slot] = index;
+			process->resident++;
+			if (process->resident > process->peak)
+				process->peak = process->resident;
+			process->page_faults++;
+			process->window_faults++;
+		}
+		if (process->window_references == pool->window)
+			pool_window(pool, process);
+	}
+}
+
+/**
+ * Orders processes by pid
+ **/
+
+static int compare_pid(const void *a, const void *b) {
+	int left = ((const Process *) a)->pid;
+	int right = ((const Process *) b)->pid;
+	return (left > right) - (left < right);
+}
+
+/**
+ * Prints the faults, frames and thrashing of every process
+ **/
+
+void print_pool_stats(Pool *pool) {
+	int i;
+	int thrashing = 0;
+	//Processes are numbered by first reference, so sort a copy to list them by pid
+	Process *processes = (Process *) malloc(pool->num_of_processes * sizeof(Process));
+	if (processes == NULL && pool->num_of_processes > 0) {
+		printf("ERROR: Out of memory for %d processes\n", pool->num_of_processes);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(processes, pool->processes, pool->num_of_processes * sizeof(Process));
+	qsort(processes, pool->num_of_processes, sizeof(Process), compare_pid);
+	for (i = 0; i < pool->num_of_processes; i++) {
+		Process *process = &processes[i];
+		if (process->thrashing_windows > 0)
+			thrashing++;
+		printf("Process %d: %ld page requests, %ld page faults, fault rate %.4f, %d frames (peak %d",
+		       process->pid, process->references, process->page_faults,
+		       (double) process->page_faults / process->references, process->resident, process->peak);
+		if (pool->policy != POOL_GLOBAL)
+			printf(", allocation %d", process->allocation);
+		printf("), thrashing in %ld of %ld windows\n", process->thrashing_windows, process->windows);
+	}
+	free(processes);
+	printf("%d processes, %d thrashing", pool->num_of_processes, thrashing);
+	if (pool->policy != POOL_GLOBAL)
+		printf(", %ld of %d frames allocated", pool->allocated, pool->size);
+	printf("\n");
+}
+
+/**
+ * Simulates the FIFO page replacement algorithm
+ **/
+
+void FIFO(int frame[], int size, Trace *requests, Stats *stats) {
+	int replace_index = 0;
+	int page;
+	int frame_detected = 0;
+
+	while(trace_next(requests, &page)) {
+		frame_detected = find_frame(frame, size, page);
+		if(frame_detected < 0) {
+			record_load(stats, page, replace_index, frame[replace_index]);
+			frame[replace_index] = page;
+			if (replace_index + 1 == size)
+				replace_index = 0;
+			else
+				replace_index++;
+		} else {
+			record_hit(stats, page, frame_detected);
+		}
+	}
+}
+
+/**
+ * Simulates the OPT page replacement algorithm
+ **/
+
+void OPT(int frame[], int size, Trace *requests, Stats *stats) {
+
+	int frame_detected = 0;
+	int i;
+	int index_replace_time = 0;
+	int longest_replace_time = 0;
+	int replace_index = 0;
+	int page;
+
+	while(trace_next(requests, &page)) {
+		frame_detected = find_frame(frame, size, page);
+		if(frame_detected < 0) {
+			if (replace_index < size && frame[replace_index] == -1) {
+				record_load(stats, page, replace_index, -1);
+				frame[replace_index] = page;
+				replace_index++;
+			} else {
+				for (i = 0; i < size; i++) {
+					index_replace_time = find_opt_replace_index(frame[i], requests);
+					if (longest_replace_time < index_replace_time) {
+						replace_index = i;
+						longest_replace_time = index_replace_time;
+					}
+				}
+				record_load(stats, page, replace_index, frame[replace_index]);
+				frame[replace_index] = page;
+				longest_replace_time = 0;
+			}
+		} else {
+			record_hit(stats, page, frame_detected);
+		}
+	}
+}
+
+/**
+ * Simulates the LRU page replacement algorithm
+ **/
+
+void LRU(int frame[], int size, Trace *requests, Stats *stats) {
+
+	int frame_detected = 0;
+	int replace_index = 0;
+	int page;
+	long time = 0;
+	long *last_use = (long *) malloc(size * sizeof(long));
+
+	if (last_use == NULL) {
+		printf("ERROR: Cannot allocate the use times of %d frames\n", size);
+		exit(EXIT_FAILURE);
+	}
+	while(trace_next(requests, &page)) {
+		frame_detected = find_frame(frame, size, page);
+		if(frame_detected < 0) {
+			if (replace_index < size && frame[replace_index] == -1) {
+				record_load(stats, page, replace_index, -1);
+				frame[replace_index] = page;
+				last_use[replace_index] = time;
+				replace_index++;
+			} else {
+				replace_index = find_LRU_replace_index(last_use, size);
+				record_load(stats, page, replace_index, frame[replace_index]);
+				frame[replace_index] = page;
+				last_use[replace_index] = time;
+			}
+		} else {
+			record_hit(stats, page, frame_detected);
+			last_use[frame_detected] = time;
+		}
+		time++;
+	}
+	free(last_use);
+}
+
+/**
+ * Simulates working set replacement. A page stays loaded while it
+ * was referenced within the last tau references, so frames are freed
+ * as pages age out even when memory is not short. Loaded frames are
+ * kept on a list in order of last use, which makes both aging out and
+ * the forced LRU replacement when every frame is busy O(1).
+ **/
+
+void WS(int frame[], int size, Trace *requests, Stats *stats, long tau, long window) {
+
+	int frame_detected = 0;
+	int replace_index = 0;
+	int page;
+	int head = -1;
+	int tail = -1;
+	int free_count = size;
+	int resident = 0;
+	int linked;
+	int i;
+	long time = 0;
+	long window_faults = 0;
+	long *last_use = (long *) malloc(size * sizeof(long));
+	int *prev = (int *) malloc(size * sizeof(int));
+	int *next = (int *) malloc(size * sizeof(int));
+	int *free_frames = (int *) malloc(size * sizeof(int));
+
+	if (last_use == NULL || prev == NULL || next == NULL || free_frames == NULL) {
+		printf("ERROR: Cannot allocate the working set of %d frames\n", size);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < size; i++)
+		free_frames[i] = size - 1 - i;
+
+	while(trace_next(requests, &page)) {
+		//Age out the pages not referenced within the window
+		while (head >= 0 && time - last_use[head] >= tau) {
+			record_unload(stats, frame[head], head);
+			frame[head] = -1;
+			free_frames[free_count++] = head;
+			resident--;
+			head = next[head];
+			if (head >= 0)
+				prev[head] = -1;
+			else
+				tail = -1;
+		}
+		frame_detected = find_frame(frame, size, page);
+		linked = 1;
+		if(frame_detected < 0) {
+			if (free_count > 0) {
+				replace_index = free_frames[--free_count];
+				record_load(stats, page, replace_index, -1);
+				resident++;
+				linked = 0;
+			} else {
+				replace_index = head;
+				record_load(stats, page, replace_index, frame[replace_index]);
+			}
+			frame[replace_index] = page;
+		} else {
+			record_hit(stats, page, frame_detected);
+			replace_index = frame_detected;
+		}
+		//Move the frame to the most recently used end of the list
+		if (replace_index != tail) {
+			if (linked) {
+				if (prev[replace_index] >= 0)
+					next[prev[replace_index]] = next[replace_index];
+				else
+					head = next[replace_index];
+				prev[next[replace_index]] = prev[replace_index];
+			}
+			prev[replace_index] = tail;
+			next[replace_index] = -1;
+			if (tail >= 0)
+				next[tail] = replace_index;
+			else
+				head = replace_index;
+			tail = replace_index;
+		}
+		last_use[replace_index] = time;
+		time++;
+		if (time % window == 0)
+			record_window(stats, window, resident, &window_faults);
+	}
+	free(last_use);
+	free(prev);
+	free(next);
+	free(free_frames);
+}
+
+/**
+ * Simulates the WSClock page replacement algorithm. Each frame keeps
+ * a referenced bit and the virtual time of its last use, updated when
+ * the clock hand passes a referenced frame. On a fault the hand
+ * replaces the first unreferenced page older than tau, or the oldest
+ * page it saw when a whole sweep finds none. The time series counts
+ * the working set from the exact time of each frame's last reference.
+ **/
+
+void WSCLOCK(int frame[], int size, Trace *requests, Stats *stats, long tau, long window) {
+
+	int frame_detected = 0;
+	int replace_index = 0;
+	int page;
+	int hand = 0;
+	int loaded = 0;
+	int working_set;
+	int i;
+	long time = 0;
+	long window_faults = 0;
+	long *last_use = (long *) malloc(size * sizeof(long));
+	long *last_reference = (long *) malloc(size * sizeof(long));
+	char *referenced = (char *) malloc(size);
+
+	if (last_use == NULL || last_reference == NULL || referenced == NULL) {
+		printf("ERROR: Cannot allocate the clock of %d frames\n", size);
+		exit(EXIT_FAILURE);
+	}
+	while(trace_next(requests, &page)) {
+		frame_detected = find_frame(frame, size, page);
+		if(frame_detected < 0) {
+			if (loaded < size) {
+				replace_index = loaded++;
+				record_load(stats, page, replace_index, -1);
+			} else {
+				int oldest = -1;
+				replace_index = -1;
+				for (i = 0; i < size && replace_index < 0; i++) {
+					if (referenced[hand]) {
+						referenced[hand] = 0;
+						last_use[hand] = time;
+					} else if (time - last_use[hand] >= tau) {
+						replace_index = hand;
+					} else if (oldest < 0 || last_use[hand] < last_use[oldest]) {
+						oldest = hand;
+					}
+					if (replace_index < 0)
+						hand = (hand + 1) % size;
+				}
+				if (replace_index < 0)
+					replace_index = oldest >= 0 ? oldest : hand;
+				hand = (replace_index + 1) % size;
+				record_load(stats, page, replace_index, frame[replace_index]);
+			}
+			frame[replace_index] = page;
+			referenced[replace_index] = 1;
+			last_use[replace_index] = time;
+			last_reference[replace_index] = time;
+		} else {
+			record_hit(stats, page, frame_detected);
+			referenced[frame_detected] = 1;
+			last_reference[frame_detected] = time;
+		}
+		time++;
+		if (time % window == 0) {
+			working_set = 0;
+			for (i = 0; i < loaded; i++) {
+				if (time - last_reference[i] <= tau)
+					working_set++;
+			}
+			record_window(stats, window, working_set, &window_faults);
+		}
+	}
+	free(last_use);
+	free(last_reference);
+	free(referenced);
+}
+
+/**
+ * Searches for the next index to be replaced
+ * based on when the page will be accessed in the future.
+ * Stream traces only look as far as their window.
+ **/
+
+int find_opt_replace_index(int page, Trace *current) {
+	Trace temp = *current;
+	int time = NO_FUTURE_USE;
+	int jumps = 1;
+	int next;
+	if (current->kind == TRACE_STREAM) {
+		fill_window(current);
+		for (jumps = 1; jumps <= current->window_count; jumps++) {
+			if (current->window[(current->window_head + jumps - 1) % current->window_size] == page)
+				return jumps;
+		}
+		return time;
+	}
+	while(trace_next(&temp, &next)) {
+		if (next == page) {
+			time = jumps;
+			break;
+		} else {
+			jumps++;
+		}
+	}
+
+	return time;
+}
+
+/**
+ * Searches for the next index to be replaced
+ * based on past information about the pages accessed
+ **/
+
+int find_LRU_replace_index(long last_use[], int size) {
+	int i;
+	int oldest = 0;
+	for (i = 1; i < size; i++) {
+		if (last_use[i] < last_use[oldest])
+			oldest = i;
+	}
+
+	return oldest;
+}